@@ -1,15 +1,49 @@
 #pragma once
 
 #include <algorithm> // for std::sort(), std::max()
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <cstddef> // for ptrdiff_t
+#include <cstdint>
+#include <cstdio> // for printf(), snprintf()
+#include <cstdlib> // for strtod()
+#include <cstring> // for strlen(), strcmp()
+#include <limits>
+#include <memory> // for std::unique_ptr
 #include <string>
+#include <type_traits> // for std::integral_constant
+#include <utility> // for std::pair
 #include <vector>
 
-#define DT_FLOATS
 #ifndef DT_NO_CHRONO
 #include <chrono>
 #endif // DT_NO_CHRONO
 
+// The TSC is calibrated against std::chrono::steady_clock
+#if !defined(DT_NO_CHRONO) && defined(__x86_64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define DT_HAS_TSC
+#include <cpuid.h>
+#include <x86intrin.h> // for __rdtscp()
+#endif
+
+// Vectorized statistics, define DT_NO_SIMD for the scalar code
+#if !defined(DT_NO_SIMD) && defined(__AVX__)
+#define DT_SIMD_AVX
+#include <immintrin.h>
+#elif !defined(DT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define DT_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef DT_THREADSAFE
+#include <mutex>
+#include <thread>
+#define DT_THREAD_LOCAL thread_local
+#else
+#define DT_THREAD_LOCAL
+#endif // DT_THREADSAFE
+
 
 namespace dt {
 
@@ -19,41 +53,304 @@ namespace dt {
    using float_type = double;
 #endif
 
+   // Times in ms. Evaluating them only needs a few order statistics, so they
+   // are only fully sorted when they are first read. Not thread-safe, read
+   // them once before sharing the results between threads.
+   struct SortedTimes {
+      [[nodiscard]] auto get() const -> const std::vector<float_type>&;
+      operator const std::vector<float_type>&() const { return get(); }
+      [[nodiscard]] auto size() const -> size_t { return m_times.size(); }
+      [[nodiscard]] auto empty() const -> bool { return m_times.empty(); }
+      [[nodiscard]] auto begin() const { return get().begin(); }
+      [[nodiscard]] auto end() const { return get().end(); }
+      [[nodiscard]] auto operator[](const size_t i) const -> float_type { return get()[i]; }
+
+      mutable std::vector<float_type> m_times;
+      mutable bool m_sorted = false;
+   };
+
    struct ZoneResult {
       std::string name;
-      std::vector<float_type> sorted_frame_times;
-      std::vector<float_type> sorted_zone_times;
+      SortedTimes sorted_frame_times;
+      SortedTimes sorted_zone_times;
+      std::vector<std::int64_t> frame_ticks; // clock ticks in recording order, with the rejected outliers. Only with Config::keep_raw_ticks
+      std::vector<std::int64_t> zone_ticks;
       float_type median;
       float_type zonetime_median;
       float_type mean;
       float_type worst_time;
       float_type std_dev;
+      std::vector<float_type> percentiles; // frame times at Config::percentiles
+      float_type ci_low = static_cast<float_type>(0.0); // 95% bootstrap CI of the median difference to the baseline
+      float_type ci_high = static_cast<float_type>(0.0);
+      float_type p_value = static_cast<float_type>(1.0); // of the difference to the baseline, see SignificanceTest
+      size_t rejected_count = 0; // outliers not in sorted_frame_times and the statistics, see OutlierPolicy
+      std::vector<float_type> thread_zonetime_means; // per thread, in order of their first timezone
+      size_t parent = 0; // index of the enclosing timezone, 0 at the top level
+      float_type inclusive_delta = static_cast<float_type>(0.0); // median difference to the baseline in ms, nested zones included
+      float_type exclusive_delta = static_cast<float_type>(0.0); // inclusive_delta minus those of the nested zones
    };
 
-   inline struct Results {
-      std::vector<ZoneResult> zone_results;
-      std::string result_str;
-   } results;
+   // Linear fit of the frame times over the fraction of one dt::workload().
+   // The baseline counts as fraction 1.
+   struct WorkloadResult {
+      std::string name;
+      std::vector<ZoneResult> fraction_results; // one per valid Config::workload_fractions
+      float_type cost; // slope in ms per full workload, i.e. the marginal cost
+      float_type cost_ci; // half width of its 95% confidence interval
+      float_type fixed_time; // intercept in ms, the predicted frame time at fraction 0
+   };
+
+   // Two zones disabled together, see InteractionMode
+   struct InteractionResult {
+      size_t zone_a; // indices into Results::zone_results
+      size_t zone_b;
+      ZoneResult result; // with both disabled, compared to the baseline
+      float_type interaction; // median ms saved by disabling both, minus what disabling each on its own saves
+   };
 
-   enum class Status { Ready, Starting, Measuring };
+   enum class Status { Ready, Starting, Measuring, Evaluating };
    enum class ReportOutMode { JustEval, ConsoleOut };
    enum class ReportTimeMode { Ms, Fps };
+   enum class ScheduleMode { Blocks, Interleaved };
+   enum class SignificanceTest { MannWhitney, Welch };
+   enum class SampleStorage { Full, Sketch };
+   enum class OutlierPolicy { None, Mad, Iqr, TrimmedMean };
+   enum class InteractionMode { None, Pairwise };
+
+   // DDSketch of clock ticks: logarithmically spaced buckets, so every quantile
+   // is within the relative accuracy of a recorded value. Non-positive values
+   // go into zero_count. Memory is bounded by collapsing the lowest buckets.
+   struct QuantileSketch {
+      std::vector<std::int64_t> counts; // [i] counts bucket min_index + i
+      int min_index = 0;
+      double log_gamma = 0.0; // log((1+accuracy) / (1-accuracy))
+      std::int64_t zero_count = 0;
+      std::int64_t count = 0;
+      std::int64_t min_value = 0;
+      std::int64_t max_value = 0;
+   };
 
    struct Zone {
       std::string name;
-      std::vector<float_type> frame_times;
-      std::vector<float_type> zone_times;
-      float_type zone_buffer = static_cast<float_type>(0.0);
+      std::vector<std::int64_t> frame_times; // in clock ticks, empty with SampleStorage::Sketch
+      QuantileSketch frame_sketch; // only with SampleStorage::Sketch
+      size_t frame_count = 0;
+      double frame_tick_mean = 0.0; // running (Welford) statistics of the frame times
+      double frame_tick_m2 = 0.0;
+      std::vector<std::int64_t> zone_times; // in clock ticks, empty with SampleStorage::Sketch
+      QuantileSketch zone_sketch; // only with SampleStorage::Sketch
+      size_t zone_count = 0;
+      std::int64_t zone_buffer = 0;
+      std::int64_t zone_buffer_count = 0; // timezones in zone_buffer, a slice with only empty ones still records 0
+      std::vector<std::int64_t> thread_zone_sums; // [thread] is that thread's share of all zone times
+      std::vector<std::int64_t> thread_zone_buffers; // this slice's zone_buffer per thread
+      size_t parent = 0; // the timezone this one was first seen nested in, 0 for none
+   };
+
+   // Several zones disabled at once. Only zones 1 to 63 fit in the mask.
+   struct Combination {
+      std::uint64_t disabled_mask = 0; // bit i disables zone i
+      Zone record; // the frame times with all of them disabled
+   };
+
+   // A stage with several implementations, see dt::variant()
+   struct Variant {
+      std::string name;
+      int count = 2;
+   };
+
+   // One implementation of a variant other than the default 0
+   struct Alternative {
+      size_t variant = 0; // index into State::variants
+      int choice = 0;
+      Zone record; // named "name #choice"
+   };
+
+   // One zone virtually sped up, see Config::virtual_speedup
+   struct Speedup {
+      size_t zone = 0; // index into State::zones
+      Zone record; // named like the zone
+   };
+
+   // A fraction of one dt::workload()
+   struct WorkloadPoint {
+      size_t workload = 0; // index into State::workloads
+      float_type fraction = static_cast<float_type>(1.0);
+      Zone record; // named "name x0.5"
+   };
+
+   // What the zone checks need to know about the configuration being measured.
+   // Published as a whole, so that no thread mixes two configurations.
+   struct TargetConfig {
+      size_t target_zone = 0; // always 0 when not measuring
+      std::uint64_t disabled_mask = 0; // zones disabled by a combination, 0 otherwise
+      size_t speedup_zone = 0; // virtually sped up zone, 0 otherwise
+      size_t target_variant = 0; // variant index + 1 of the alternative running, 0 otherwise
+      int variant_choice = 0; // what dt::variant() returns for the target variant
+      size_t target_workload = 0; // workload index + 1 of the point running, 0 otherwise
+      float_type workload_fraction = static_cast<float_type>(1.0); // what dt::workload() returns for the target workload
+   };
+
+   // Compile-time hashed zone name, see DT_ZONE()
+   struct ZoneId {
+      std::uint64_t hash;
+      const char* name;
    };
 
+   // Open-addressed (linear probing) map from ZoneId hashes to zone indices.
+   // Slots with zone_index 0 are empty since the null zone is never in here.
+   struct ZoneTable {
+      struct Slot {
+         std::uint64_t hash = 0;
+         const char* name = nullptr; // literal of the first DT_ZONE() call site
+         size_t zone_index = 0;
+      };
+      std::vector<Slot> slots;
+      size_t used = 0;
+   };
+
+   // Everything the zone lookups read. It's never changed once published: a
+   // new zone publishes a new copy, so lookups don't need a lock.
+   struct Registry {
+      std::vector<std::string> names; // [0] is the null zone
+      ZoneTable table;
+      std::vector<std::string> variant_names; // see dt::variant()
+      std::vector<std::string> workload_names; // see dt::workload()
+   };
+
+   namespace details {
+
+#ifdef DT_THREADSAFE
+      using mutex_type = std::mutex;
+#else
+      struct mutex_type {
+         auto lock() -> void {}
+         auto unlock() -> void {}
+      };
+#endif // DT_THREADSAFE
+
+#ifdef DT_THREADSAFE
+      // Joined on destruction, so that an evaluation still running at exit
+      // finishes instead of terminating
+      struct EvaluationThread {
+         EvaluationThread() = default;
+         EvaluationThread(const EvaluationThread&) = delete;
+         auto operator=(const EvaluationThread&) -> EvaluationThread& = delete;
+         ~EvaluationThread() { join(); }
+         auto join() -> void {
+            // the done callback can call factory_reset() on the thread itself
+            if (thread.joinable() && thread.get_id() != std::this_thread::get_id())
+               thread.join();
+         }
+         std::thread thread;
+      };
+#endif // DT_THREADSAFE
+
+      struct ScopedLock {
+         explicit ScopedLock(mutex_type& mutex) : m_mutex(mutex) { m_mutex.lock(); }
+         ~ScopedLock() { m_mutex.unlock(); }
+         ScopedLock(const ScopedLock&) = delete;
+         auto operator=(const ScopedLock&) -> ScopedLock& = delete;
+         mutex_type& m_mutex;
+      };
+
+      // Something read without the lock. Replaced versions are kept with the
+      // epoch they were replaced in, until no read that could have seen them
+      // is left. See ReadGuard.
+      template<class T>
+      struct Versions {
+         std::unique_ptr<T> current;
+         std::vector<std::pair<std::uint64_t, std::unique_ptr<T>>> retired;
+      };
+
+      // Each total sits on its own cache line so that neither other threads
+      // nor the merging in slice() cause false sharing with the owner
+      struct alignas(64) PaddedTotal {
+         std::atomic<std::int64_t> value{ 0 };
+         std::atomic<std::int64_t> count{ 0 }; // timezones in value
+         std::atomic<size_t> parent{ 0 }; // the timezone this one was last opened or checked in, 0 for none
+      };
+
+      // Zone times of one thread. Only the owning thread writes and it keeps
+      // running totals, so slice() can merge the differences without a lock.
+      struct ThreadBuffer {
+         struct Totals {
+            explicit Totals(const size_t n) : size(n), values(new PaddedTotal[n]) {}
+            size_t size;
+            std::unique_ptr<PaddedTotal[]> values;
+         };
+         std::atomic<const Totals*> totals{ nullptr };
+         std::vector<std::unique_ptr<Totals>> storage; // owner only, old arrays stay alive for slice()
+         std::vector<std::int64_t> merged; // slice() only, totals already merged
+         std::vector<std::int64_t> merged_counts; // slice() only, same for the counts
+         std::atomic<std::int64_t> paid_delay{ 0 }; // virtual speedup delay this thread has waited, see State::speedup_delay
+         std::atomic<std::uint64_t> read_epoch{ 0 }; // see ReadGuard, 0 outside of one
+         size_t index = 0; // in State::thread_buffers, also the tid in traces
+      };
+
+      struct TraceEvent {
+         std::uint32_t zone_index; // 0 is the frame
+         std::uint32_t thread_index;
+         std::int64_t t0; // clock ticks
+         std::int64_t t1;
+      };
+
+      // Preallocated ring, see Config::trace_capacity. Writers only claim a
+      // slot, so it's only consistent to read when nothing is measured.
+      struct TraceBuffer {
+         struct Storage {
+            explicit Storage(const size_t n) : capacity(n), events(new TraceEvent[n]) {}
+            size_t capacity;
+            std::unique_ptr<TraceEvent[]> events;
+         };
+         std::atomic<Storage*> storage{ nullptr }; // nullptr when not recording, only replaced when a measurement starts
+         Versions<Storage> storages; // with the mutex, retired like State::registry_versions
+         std::atomic<size_t> next{ 0 }; // events recorded so far, the ring wraps around
+      };
+
+      inline const TargetConfig null_target_config{}; // everything enabled, before any set_target_config()
+
+   } // namespace details
+
 
    inline struct State {
-      Status status = Status::Ready;
-      std::vector<Zone> zones;
-      size_t target_zone = 0;
-      std::chrono::high_resolution_clock::time_point t0;
-      int recorded_slices = 0;
+      std::atomic<Status> status{ Status::Ready };
+      std::vector<Zone> zones; // only touched with the mutex locked
+      std::atomic<const Registry*> registry{ nullptr };
+      details::Versions<Registry> registry_versions; // the published registry and the replaced ones lookups may still read
+      std::atomic<std::uint64_t> epoch{ 1 }; // bumped when a version is replaced, see ReadGuard
+      std::vector<std::unique_ptr<details::ThreadBuffer>> thread_buffers;
+      details::mutex_type mutex; // for registration, slice() and resets. Never on the zone checks
+      std::atomic<const TargetConfig*> target{ &details::null_target_config };
+      std::vector<std::unique_ptr<TargetConfig>> target_snapshots; // never changed once published, only freed by factory_reset()
+      std::array<std::vector<const TargetConfig*>, 5> config_targets; // [range][i] the snapshot of each configuration, see get_config_ranges()
+      size_t target_config = 0; // zone index or one of the offsets + index, see combination_config_offset
+      std::vector<Combination> combinations; // only touched with the mutex locked
+      std::atomic<double> speedup_fraction{ 0.0 }; // see Config::virtual_speedup
+      std::atomic<std::int64_t> speedup_delay{ 0 }; // ticks every thread has to wait, only grows
+      std::int64_t counted_speedup_delay = 0; // slice() only, already subtracted from the frame times
+      std::vector<Speedup> speedups; // one per zone that a timezone measured
+      std::vector<bool> sped_up_zones; // [zone] is in speedups
+      std::vector<Variant> variants; // only touched with the mutex locked
+      std::vector<Alternative> alternatives; // only touched with the mutex locked
+      std::vector<std::string> workloads; // only touched with the mutex locked
+      std::vector<WorkloadPoint> workload_points; // only touched with the mutex locked
+      std::atomic<int> generation{ 0 }; // bumped by factory_reset() to invalidate ZoneHandles
+      std::atomic<std::int64_t> timezone_overhead{ 0 }; // ticks a timezone measures on top of its content
+      std::int64_t t0 = 0; // clock ticks
+      std::atomic<double> ms_per_tick{ 1.0 / 1'000'000.0 }; // set by the clock calibration in start(), read by slice(float_type) without the lock
+      int recorded_slices = 0; // in the current block
+      int block_size = 0; // slices to record before the target zone changes
       int warmup_runs_left = 0;
+      std::vector<size_t> schedule; // zone order of the current interleaved round
+      size_t schedule_pos = 0;
+      std::uint64_t rng_state = 0;
+      double sketch_log_gamma = 0.0; // 0 stores every sample, see SampleStorage
+#ifdef DT_THREADSAFE
+      details::EvaluationThread evaluation_thread; // see Config::async_evaluation
+#endif // DT_THREADSAFE
+      details::TraceBuffer trace; // baseline frames and timezones, see Config::trace_capacity
    } dt_state;
 
    typedef void (*DoneCallback)(const std::vector<ZoneResult>& zone_results);
@@ -62,27 +359,131 @@ namespace dt {
       ReportOutMode report_out_mode = ReportOutMode::ConsoleOut;
       ReportTimeMode report_time_mode = ReportTimeMode::Ms;
       int target_sample_count = 100;
+      float_type target_ci_width = static_cast<float_type>(0.0); // relative to the baseline mean, 0 means a fixed sample count
+      int min_sample_count = 20; // only with target_ci_width
+      int max_sample_count = 10'000; // only with target_ci_width
       int warmup_runs = 10;
+      std::vector<float_type> percentiles{ 90.0, 99.0, 99.9 }; // of the frame times, one report column each
+      int bootstrap_resamples = 1000; // for the CIs, 0 disables them
+      SampleStorage sample_storage = SampleStorage::Full;
+      float_type sketch_accuracy = static_cast<float_type>(0.01); // relative, only with SampleStorage::Sketch
+      InteractionMode interaction_mode = InteractionMode::None;
+      size_t max_pairwise_zones = 16; // the first zones registered, 120 pairs. At most 63
+      float_type virtual_speedup = static_cast<float_type>(0.0); // fraction between 0 and 1, 0 disables the virtual speedup configurations
+      std::vector<float_type> workload_fractions{ 0.25, 0.5, 0.75 }; // measured for every dt::workload(), next to 1 in the baseline. Each in [0, 1)
+      size_t trace_capacity = 0; // events kept for dt::write_trace_json(), 0 disables the recording
+      OutlierPolicy outlier_policy = OutlierPolicy::None;
+      float_type outlier_threshold = static_cast<float_type>(3.5); // MAD: modified z-score, IQR: fence factor
+      float_type trim_fraction = static_cast<float_type>(0.05); // per tail, only with OutlierPolicy::TrimmedMean
+      SignificanceTest significance_test = SignificanceTest::MannWhitney;
+      float_type significance_level = static_cast<float_type>(0.05); // zones above are flagged as not significant
+      ScheduleMode schedule_mode = ScheduleMode::Blocks;
+      int interleave_block_size = 1; // interleaved blocks are between 1 and this many slices long
+      int switch_warmup_runs = 1; // after each change of the target zone in interleaved mode
+      bool subtract_timezone_overhead = true;
+      bool keep_raw_ticks = false; // copies the recorded ticks into the results, for the export
+      bool async_evaluation = false; // only with DT_THREADSAFE
       DoneCallback done_cb = nullptr;
    } config;
 
+   inline struct Results {
+      std::vector<ZoneResult> zone_results;
+      std::vector<InteractionResult> interaction_results;
+      std::vector<ZoneResult> speedup_results; // each timed zone virtually sped up, compared to the baseline
+      std::vector<ZoneResult> variant_results; // every alternative of every dt::variant(), compared to the baseline
+      std::vector<WorkloadResult> workload_results;
+      std::string result_str;
+      float_type timezone_overhead_ms = static_cast<float_type>(0.0); // subtracted from every timezone
+      Config config; // that produced these results, dt::config may have changed since
+      double ms_per_tick = 0.0; // of the clock calibration of the measurement
+      size_t thread_count = 0; // that recorded timezones or slices
+   } results;
+
    namespace details {
       struct ZoneGuard;
    }
 
+#ifndef DT_DISABLE
+   // Registers the zone once and caches its index. Checking it compares the
+   // cached generation and the target instead of looking up a string, plus
+   // the parent bookkeeping inside a timezone. Best kept in a static local:
+   // static dt::ZoneHandle shadows("draw shadows");
+   struct ZoneHandle {
+      explicit ZoneHandle(const std::string& zone_name);
+      [[nodiscard]] auto active() -> bool;
+      [[nodiscard]] auto get_index() -> size_t;
+      [[nodiscard]] static auto get_slot(const size_t index, const int generation) -> std::uint64_t;
+
+      std::string m_name;
+      std::atomic<std::uint64_t> m_slot; // generation << 32 | index, so that threads sharing the handle read both at once
+   };
+
    inline auto zone(const std::string& zone_name) -> bool;
+   inline auto zone(ZoneHandle& handle) -> bool;
+   inline auto zone(const ZoneId& id) -> bool;
    inline auto timezone(const std::string& zone_name) -> details::ZoneGuard;
+   inline auto timezone(ZoneHandle& handle) -> details::ZoneGuard;
+   inline auto timezone(const ZoneId& id) -> details::ZoneGuard;
+   inline auto variant(const std::string& variant_name, const int variant_count) -> int;
+   inline auto workload(const std::string& workload_name) -> float_type;
    inline auto start() -> void;
    inline auto slice(const float_type time_delta_ms) -> void;
 #ifndef DT_NO_CHRONO
    inline auto slice() -> void;
 #endif // DT_NO_CHRONO
+#else
+   // With DT_DISABLE, everything on the hot path is a constexpr no-op and the
+   // compiler removes the branches. Config and results are still there.
+   namespace details {
+      struct NullGuard {
+         constexpr operator bool() const { return true; }
+      };
+   }
+
+   struct ZoneHandle {
+      template<class T>
+      constexpr explicit ZoneHandle(const T&) {}
+      [[nodiscard]] constexpr auto active() const -> bool { return true; }
+   };
+
+   template<class T>
+   constexpr auto zone(const T&) -> bool { return true; }
+   template<class T>
+   [[nodiscard]] constexpr auto timezone(const T&) -> details::NullGuard { return {}; }
+   template<class T>
+   constexpr auto variant(const T&, const int) -> int { return 0; }
+   template<class T>
+   constexpr auto workload(const T&) -> float_type { return static_cast<float_type>(1.0); }
+   constexpr auto start() -> void {}
+   constexpr auto slice(const float_type) -> void {}
+   constexpr auto slice() -> void {}
+#endif // DT_DISABLE
 
    inline auto set_sample_count(const int sample_count) -> void;
+   inline auto set_adaptive_sample_count(const float_type target_ci_width, const int min_sample_count, const int max_sample_count) -> void;
    inline auto set_warmup_runs(const int warmup_runs) -> void;
    inline auto set_report_out_mode(const ReportOutMode report_out_mode) -> void;
    inline auto set_report_time_mode(const ReportTimeMode report_time_mode) -> void;
    inline auto set_done_callback(DoneCallback cb) -> void;
+   inline auto set_bootstrap_resamples(const int resamples) -> void;
+   inline auto set_percentiles(const std::vector<float_type>& percentiles) -> void;
+   inline auto set_sample_storage(const SampleStorage sample_storage, const float_type sketch_accuracy) -> void;
+   inline auto set_significance_test(const SignificanceTest test, const float_type significance_level) -> void;
+   inline auto set_outlier_policy(const OutlierPolicy policy, const float_type threshold) -> void;
+   inline auto set_interaction_mode(const InteractionMode interaction_mode) -> void;
+   inline auto set_max_pairwise_zones(const size_t max_zones) -> void;
+   inline auto set_virtual_speedup(const float_type speedup) -> void;
+   inline auto set_workload_fractions(const std::vector<float_type>& fractions) -> void;
+   inline auto set_trace_capacity(const size_t event_count) -> void;
+   inline auto write_trace_json(const std::string& path) -> bool;
+   inline auto write_results_json(const std::string& path) -> bool;
+   inline auto write_results_csv(const std::string& path) -> bool;
+   inline auto set_schedule_mode(const ScheduleMode schedule_mode) -> void;
+   inline auto set_interleave_block_size(const int max_block_size) -> void;
+   inline auto set_switch_warmup_runs(const int switch_warmup_runs) -> void;
+   inline auto set_timezone_overhead_subtraction(const bool subtract) -> void;
+   inline auto set_raw_tick_keeping(const bool keep) -> void;
+   inline auto set_async_evaluation(const bool async_evaluation) -> void;
    inline auto are_results_ready() -> bool;
    inline auto clear_results() -> void;
    inline auto factory_reset() -> void;
@@ -92,549 +493,3257 @@ namespace dt {
 
 namespace dt::details {
 
-   [[nodiscard]] constexpr auto get_ms_from_dt(
-      const std::chrono::high_resolution_clock::time_point& t1,
-      const std::chrono::high_resolution_clock::time_point& t0
-   ) -> float_type {
-      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
-      return ns / static_cast<float_type>(1'000'000.0);
+   // 64 bit FNV-1a
+   [[nodiscard]] constexpr auto get_fnv1a_hash(const char* str) -> std::uint64_t {
+      std::uint64_t hash = 14695981039346656037ull;
+      for (; *str != '\0'; ++str) {
+         hash ^= static_cast<unsigned char>(*str);
+         hash *= 1099511628211ull;
+      }
+      return hash;
    }
 
+} // namespace dt::details
 
-   struct ZoneGuard {
-      ZoneGuard(const ptrdiff_t zone_index)
-         : m_t0(std::chrono::high_resolution_clock::now())
-         , m_zone_index(zone_index)
-      {}
-      ~ZoneGuard() {
-         if (m_zone_index == -1)
-            return;
-         // only measure during null run
-         if (dt_state.target_zone != 0)
-            return;
-         const auto t1 = std::chrono::high_resolution_clock::now();
-         const float_type ms = details::get_ms_from_dt(t1, m_t0);
-         dt_state.zones[m_zone_index].zone_buffer += ms;
+
+// The hash is forced to be computed at compile time, the call site then only
+// probes the hash table. Works where a static ZoneHandle can't be kept.
+#ifndef DT_DISABLE
+#define DT_ZONE(zone_name) ::dt::zone(::dt::ZoneId{ std::integral_constant<std::uint64_t, ::dt::details::get_fnv1a_hash(zone_name)>::value, zone_name })
+#define DT_TIMEZONE(zone_name) ::dt::timezone(::dt::ZoneId{ std::integral_constant<std::uint64_t, ::dt::details::get_fnv1a_hash(zone_name)>::value, zone_name })
+#else
+#define DT_ZONE(zone_name) true
+#define DT_TIMEZONE(zone_name) ::dt::details::NullGuard{}
+#endif // DT_DISABLE
+
+
+namespace dt::details {
+
+   // Clocks return ticks in their own unit, calibrate() returns the
+   // milliseconds per tick. Ticks are only converted during evaluation.
+#ifndef DT_NO_CHRONO
+   struct ChronoClock {
+      [[nodiscard]] static auto now() -> std::int64_t {
+         const auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+         return std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
       }
-      operator bool() {
-         if (dt_state.target_zone == 0)
-            return true;
-         return static_cast<size_t>(m_zone_index) != dt_state.target_zone;
+      [[nodiscard]] static auto calibrate() -> double {
+         return 1.0 / 1'000'000.0;
       }
-      std::chrono::high_resolution_clock::time_point m_t0;
-      const ptrdiff_t m_zone_index;
    };
+#endif // DT_NO_CHRONO
 
 
-   [[nodiscard]] inline auto get_zone_index(
-      const std::string& zone_name,
-      const State& state
-   ) -> std::ptrdiff_t {
-      const auto it = std::find_if(
-         std::cbegin(state.zones),
-         std::cend(state.zones),
-         [zone_name](const Zone& zone) {
-            return zone.name == zone_name;
+#ifdef DT_HAS_TSC
+   // rdtscp is much cheaper than going through the vDSO. Falls back to
+   // ChronoClock if the TSC isn't invariant, i.e. not constant across
+   // frequency changes and cores.
+   struct TscClock {
+      [[nodiscard]] static auto now() -> std::int64_t {
+         if (!s_usable.load(std::memory_order_relaxed))
+            return ChronoClock::now();
+         unsigned int aux;
+         return static_cast<std::int64_t>(__rdtscp(&aux));
+      }
+
+      [[nodiscard]] static auto is_invariant() -> bool {
+         unsigned int eax, ebx, ecx, edx;
+         if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 27)) == 0) // rdtscp
+            return false;
+         if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+            return false;
+         return (edx & (1u << 8)) != 0;
+      }
+
+      // spins for 10ms against std::chrono::steady_clock
+      [[nodiscard]] static auto calibrate() -> double {
+         if (!is_invariant()) {
+            s_usable.store(false, std::memory_order_relaxed);
+            return ChronoClock::calibrate();
          }
-      );
-      if (it == std::cend(state.zones))
-         return -1;
-      const std::ptrdiff_t index = std::distance(std::cbegin(state.zones), it);
-      return index;
+         unsigned int aux;
+         const auto c0 = std::chrono::steady_clock::now();
+         const std::uint64_t t0 = __rdtscp(&aux);
+         auto c1 = c0;
+         while (c1 - c0 < std::chrono::milliseconds(10))
+            c1 = std::chrono::steady_clock::now();
+         const std::uint64_t t1 = __rdtscp(&aux);
+         const double ms = std::chrono::duration<double, std::milli>(c1 - c0).count();
+         s_usable.store(true, std::memory_order_relaxed);
+         return ms / static_cast<double>(t1 - t0);
+      }
+
+      inline static std::atomic<bool> s_usable{ false };
+   };
+#endif // DT_HAS_TSC
+
+
+   // DT_CLOCK can name any type with the same static now() and calibrate()
+#if defined(DT_CLOCK)
+   using clock_type = DT_CLOCK;
+#elif defined(DT_NO_CHRONO) && defined(DT_DISABLE)
+   struct NullClock { // never read, everything is a no-op
+      [[nodiscard]] static auto now() -> std::int64_t { return 0; }
+      [[nodiscard]] static auto calibrate() -> double { return 1.0; }
+   };
+   using clock_type = NullClock;
+#elif defined(DT_NO_CHRONO)
+#error "dt: without std::chrono, DT_CLOCK has to name a clock"
+#elif defined(DT_TSC) && defined(DT_HAS_TSC)
+   using clock_type = TscClock;
+#else
+   using clock_type = ChronoClock;
+#endif
+
+
+   [[nodiscard]] constexpr auto get_ms_from_ticks(
+      const std::int64_t ticks,
+      const double ms_per_tick
+   ) -> float_type {
+      return static_cast<float_type>(static_cast<double>(ticks) * ms_per_tick);
    }
 
 
-   [[nodiscard]] inline auto is_zone_known(
-      const std::string& zone_name,
-      const State& state
-   ) -> bool {
-      return get_zone_index(zone_name, state) != -1;
+   [[nodiscard]] inline auto get_ticks_from_ms(
+      const float_type ms,
+      const double ms_per_tick
+   ) -> std::int64_t {
+      return static_cast<std::int64_t>(std::llround(static_cast<double>(ms) / ms_per_tick));
    }
 
 
-   [[nodiscard]] constexpr auto is_sample_target_reached(
-      const State& state,
-      const Config& pconfig
-   ) -> bool {
-      return state.recorded_slices >= pconfig.target_sample_count;
+   // Owner only
+   [[nodiscard]] inline auto get_thread_total(
+      ThreadBuffer& buffer,
+      const size_t zone_index
+   ) -> PaddedTotal& {
+      const ThreadBuffer::Totals* totals = buffer.totals.load(std::memory_order_relaxed);
+      if (totals == nullptr || zone_index >= totals->size) {
+         const size_t old_size = totals == nullptr ? 0 : totals->size;
+         auto grown = std::make_unique<ThreadBuffer::Totals>(std::max({ size_t{ 16 }, 2 * old_size, zone_index + 1 }));
+         for (size_t i = 0; i < old_size; ++i) {
+            grown->values[i].value.store(totals->values[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            grown->values[i].count.store(totals->values[i].count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            grown->values[i].parent.store(totals->values[i].parent.load(std::memory_order_relaxed), std::memory_order_relaxed);
+         }
+         totals = grown.get();
+         buffer.storage.emplace_back(std::move(grown));
+         buffer.totals.store(totals, std::memory_order_release);
+      }
+      return totals->values[zone_index];
    }
 
 
-   [[nodiscard]] inline auto are_all_zones_done(const State& state) -> bool {
-      return state.target_zone >= state.zones.size();
+   inline auto add_to_thread_buffer(
+      ThreadBuffer& buffer,
+      const size_t zone_index,
+      const std::int64_t ticks
+   ) -> void {
+      PaddedTotal& total = get_thread_total(buffer, zone_index);
+      total.value.store(total.value.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+      total.count.store(total.count.load(std::memory_order_relaxed) + 1, std::memory_order_release); // after the value
    }
 
 
-   // doesn't touch zone names, status or t0
-   [[nodiscard]] inline auto reset_state(State& state) -> void {
-      state.target_zone = 0;
-      state.recorded_slices = 0;
-      state.warmup_runs_left = config.warmup_runs;
-      for (Zone& zone : state.zones)
-         zone.frame_times.clear();
+   // The buffer of the calling thread. Without DT_THREADSAFE, that's one buffer
+   // for everyone.
+   [[nodiscard]] inline auto get_thread_buffer(State& state) -> ThreadBuffer& {
+      struct BufferRef {
+         ThreadBuffer* buffer = nullptr;
+         int generation = -1;
+      };
+      static DT_THREAD_LOCAL BufferRef ref;
+      const int generation = state.generation.load(std::memory_order_relaxed);
+      if (ref.generation != generation) {
+         const ScopedLock lock(state.mutex);
+         state.thread_buffers.emplace_back(std::make_unique<ThreadBuffer>());
+         state.thread_buffers.back()->paid_delay = state.speedup_delay.load();
+         state.thread_buffers.back()->index = state.thread_buffers.size() - 1;
+         ref = { state.thread_buffers.back().get(), generation };
+      }
+      return *ref.buffer;
    }
 
 
-   // fun fact: median means mean of middle elements for even sizes
-   [[nodiscard]] inline auto get_median(std::vector<float_type>& sorted_vec) -> float_type {
-      if (sorted_vec.empty()) // ask stupid questions, get stupid answers
-         return 0.0;
-      if (sorted_vec.size() % 2 == 0) { // even size
-         const size_t i_middle_left = sorted_vec.size() / 2 - 1;
-         return static_cast<float_type>(0.5)* (sorted_vec[i_middle_left] + sorted_vec[i_middle_left + 1]);
+   // Marks the calling thread as reading a version published without the lock
+   // (the registry or the trace storage), with the epoch it started in. What's
+   // replaced in or after that epoch isn't freed until the read is done. The
+   // loads in it are sequentially consistent, so they can't move before the mark.
+   struct ReadGuard {
+      ReadGuard(State& state, ThreadBuffer& buffer)
+         : m_buffer(buffer)
+         , m_nested(buffer.read_epoch.load(std::memory_order_relaxed) != 0)
+      {
+         if (!m_nested)
+            m_buffer.read_epoch.store(state.epoch.load());
       }
-      else { // odd size
-         const size_t i_middle = sorted_vec.size() / 2;
-         return sorted_vec[i_middle];
+      ~ReadGuard() {
+         if (!m_nested)
+            m_buffer.read_epoch.store(0, std::memory_order_release);
       }
-   }
+      ReadGuard(const ReadGuard&) = delete;
+      auto operator=(const ReadGuard&) -> ReadGuard& = delete;
+      ThreadBuffer& m_buffer;
+      const bool m_nested;
+   };
 
 
-   // std::accumulate would require <numeric>
-   [[nodiscard]] inline auto get_mean(std::vector<float_type>& vec) -> float_type {
-      float_type sum = 0.0;
-      for (const float_type value : vec)
-         sum += value;
-      return sum / vec.size();
+   // Mutex locked. The current version is retired in this epoch.
+   template<class T, class P>
+   inline auto publish_version(
+      State& state,
+      Versions<T>& versions,
+      std::atomic<P*>& published,
+      std::unique_ptr<T> next
+   ) -> void {
+      published.store(next.get());
+      const std::uint64_t epoch = state.epoch.fetch_add(1);
+      if (versions.current != nullptr)
+         versions.retired.emplace_back(epoch, std::move(versions.current));
+      versions.current = std::move(next);
    }
 
 
-   // This is bessel-corrected!
-   [[nodiscard]] inline auto get_std_dev(
-      std::vector<float_type>& vec,
-      const float_type mean
-   ) -> float_type {
-      float_type squares = 0.0;
-      for (const float_type value : vec) {
-         const float_type term = value - mean;
-         squares += term * term;
+   // Mutex locked. Frees the versions retired before every running read started.
+   template<class T>
+   inline auto reclaim_versions(
+      const State& state,
+      Versions<T>& versions
+   ) -> void {
+      if (versions.retired.empty())
+         return;
+      std::uint64_t oldest_read = std::numeric_limits<std::uint64_t>::max();
+      for (const std::unique_ptr<ThreadBuffer>& buffer : state.thread_buffers) {
+         const std::uint64_t read_epoch = buffer->read_epoch.load();
+         if (read_epoch != 0)
+            oldest_read = std::min(oldest_read, read_epoch);
       }
-      return std::sqrt(squares / (vec.size() - static_cast<float_type>(1.0)));
+      const auto is_unread = [&](const auto& retired) { return retired.first < oldest_read; };
+      versions.retired.erase(std::remove_if(std::begin(versions.retired), std::end(versions.retired), is_unread), std::end(versions.retired));
    }
 
 
-   [[nodiscard]] inline auto get_zone_results(const std::vector<Zone>& zones) -> std::vector<ZoneResult> {
-      std::vector<ZoneResult> zone_results;
-      for (const Zone& zone : zones) {
-         ZoneResult zr;
-         zr.name = zone.name;
+   [[nodiscard]] inline auto get_target(const State& state) -> const TargetConfig& {
+      return *state.target.load(std::memory_order_acquire);
+   }
 
-         zr.sorted_frame_times = zone.frame_times;
-         std::sort(std::begin(zr.sorted_frame_times), std::end(zr.sorted_frame_times));
-         zr.sorted_zone_times = zone.zone_times;
-         std::sort(std::begin(zr.sorted_zone_times), std::end(zr.sorted_zone_times));
 
-         zr.median = get_median(zr.sorted_frame_times);
-         zr.zonetime_median = get_median(zr.sorted_zone_times);
-         zr.mean = get_mean(zr.sorted_frame_times);
-         zr.std_dev = get_std_dev(zr.sorted_frame_times, zr.mean);
-         zr.worst_time = zr.sorted_frame_times.back();
-         zone_results.emplace_back(zr);
-      }
-      return zone_results;
+   // Zone indices are never 0 and target_zone is 0 outside of measurements, so
+   // this doesn't need to look at the status
+   [[nodiscard]] inline auto is_zone_active(
+      const size_t zone_index,
+      const State& state
+   ) -> bool {
+      const TargetConfig& target = get_target(state);
+      if (zone_index == target.target_zone)
+         return false;
+      return zone_index >= 64 || ((target.disabled_mask >> zone_index) & 1) == 0;
    }
 
 
-   inline auto record_slice(State& state, const float_type time_delta_ms) -> void {
-      state.zones[state.target_zone].frame_times.emplace_back(time_delta_ms);
-      for (Zone& zone : state.zones) {
-         if (zone.zone_buffer > 0)
-            zone.zone_times.emplace_back(zone.zone_buffer);
-      }
-      ++state.recorded_slices;
+   inline auto spin_for(const std::int64_t ticks) -> void {
+      const std::int64_t t_end = clock_type::now() + ticks;
+      while (clock_type::now() < t_end) {}
    }
 
 
-   inline auto start_next_zone_measurement(State& state) -> void {
-      ++state.target_zone;
-      state.recorded_slices = 0;
+   // Causal profiling like Coz: instead of making the sped up zone faster,
+   // everything else waits for the fraction of its time. Its own thread is
+   // credited the delay right away, the others wait for it at the end of their
+   // next timezone. slice() subtracts the delays from the frame times.
+   inline auto apply_virtual_speedup(
+      State& state,
+      const size_t zone_index,
+      const size_t speedup_zone,
+      const std::int64_t zone_ticks
+   ) -> void {
+      ThreadBuffer& buffer = get_thread_buffer(state);
+      if (zone_index == speedup_zone) {
+         const double fraction = state.speedup_fraction.load(std::memory_order_relaxed);
+         const std::int64_t delay = static_cast<std::int64_t>(std::llround(fraction * static_cast<double>(zone_ticks)));
+         if (delay <= 0)
+            return;
+         state.speedup_delay.fetch_add(delay, std::memory_order_relaxed);
+         buffer.paid_delay.fetch_add(delay, std::memory_order_relaxed);
+         return;
+      }
+      const std::int64_t owed = state.speedup_delay.load(std::memory_order_relaxed) - buffer.paid_delay.load(std::memory_order_relaxed);
+      if (owed <= 0)
+         return;
+      spin_for(owed);
+      buffer.paid_delay.fetch_add(owed, std::memory_order_relaxed);
    }
 
 
-   namespace printing {
+   // Everything enabled and every variant at 0
+   [[nodiscard]] inline auto is_null_run(const TargetConfig& target) -> bool {
+      return target.target_zone == 0
+         && target.disabled_mask == 0
+         && target.target_variant == 0
+         && target.target_workload == 0;
+   }
 
-      [[nodiscard]] auto inline get_max_zone_name_len(
-         const std::vector<ZoneResult>& zone_results,
-         const int min_len
-      ) -> int {
-         int max_name_len = min_len;
-         for (const ZoneResult& result : zone_results) {
-            const int len = static_cast<int>(result.name.length());
-            if (len > max_name_len)
-               max_name_len = len;
-         }
-         return max_name_len;
-      }
 
+   // Timezones on other threads may still write into the old storage, so it
+   // is only retired. Mutex locked, only called when a measurement starts.
+   inline auto resize_trace(
+      State& state,
+      const size_t capacity
+   ) -> void {
+      TraceBuffer& trace = state.trace;
+      const TraceBuffer::Storage* current = trace.storage.load(std::memory_order_relaxed);
+      if ((current == nullptr ? 0 : current->capacity) == capacity)
+         return;
+      auto storage = capacity == 0 ? nullptr : std::make_unique<TraceBuffer::Storage>(capacity);
+      publish_version(state, trace.storages, trace.storage, std::move(storage));
+   }
 
-      enum class EvalType { Median, Mean, Worst, StdDev, ZonetimeMedian };
 
+   // The events in the order they were recorded, the oldest were overwritten
+   [[nodiscard]] inline auto get_trace_events(const TraceBuffer& trace) -> std::vector<TraceEvent> {
+      const TraceBuffer::Storage* storage = trace.storage.load(std::memory_order_acquire);
+      if (storage == nullptr)
+         return {};
+      const size_t recorded = trace.next.load();
+      const size_t count = std::min(recorded, storage->capacity);
+      const size_t first = recorded > storage->capacity ? recorded % storage->capacity : 0;
+      std::vector<TraceEvent> events;
+      events.reserve(count);
+      for (size_t i = 0; i < count; ++i)
+         events.emplace_back(storage->events[(first + i) % storage->capacity]);
+      return events;
+   }
 
-      [[nodiscard]] constexpr auto get_result_eval(
-         const ZoneResult& result,
-         const EvalType eval_type,
-         const ReportTimeMode time_mode
-      ) -> float_type {
-         if (eval_type == EvalType::StdDev)
-            return result.std_dev;
-         float_type ms_value = static_cast<float_type>(0.0);
-         if (eval_type == EvalType::Median)
-            ms_value = result.median;
-         else if (eval_type == EvalType::ZonetimeMedian)
-            ms_value = result.zonetime_median;
-         else if (eval_type == EvalType::Mean)
-            ms_value = result.mean;
-         else if (eval_type == EvalType::Worst)
-            ms_value = result.worst_time;
 
-         if (time_mode == ReportTimeMode::Ms)
-            return ms_value;
-         else
-            return static_cast<float_type>(1000.0) / ms_value;
-      }
+   inline auto record_trace_event(
+      State& state,
+      ThreadBuffer& buffer,
+      const size_t zone_index,
+      const std::int64_t t0,
+      const std::int64_t t1
+   ) -> void {
+      const ReadGuard guard(state, buffer);
+      TraceBuffer::Storage* storage = state.trace.storage.load();
+      if (storage == nullptr)
+         return;
+      const size_t slot = state.trace.next.fetch_add(1, std::memory_order_relaxed) % storage->capacity;
+      storage->events[slot] = { static_cast<std::uint32_t>(zone_index), static_cast<std::uint32_t>(buffer.index), t0, t1 };
+   }
 
 
-      template<class T>
-      [[nodiscard]] constexpr auto auto_get_digits_before_point(const T num) -> int {
-         if (std::abs(num) < static_cast<float_type>(1.0))
-            return 0;
-         return std::max(static_cast<int>(std::log10(std::abs(num))) + 1, 0);
-      }
+   // Innermost timezone of the calling thread, 0 for none
+   [[nodiscard]] inline auto get_open_timezone() -> size_t& {
+      static DT_THREAD_LOCAL size_t open_timezone = 0;
+      return open_timezone;
+   }
 
 
-      [[nodiscard]] inline auto get_fractional_string(
-         const float_type num,
-         const int digits
-      ) -> std::string {
-         float_type integral;
-         const float_type fractional = std::modf(num, &integral);
-         const float_type x = fractional * static_cast<float_type>(std::pow(static_cast<float_type>(10.0), digits));
-         const int i = static_cast<int>(std::round(x));
-         std::string s = std::to_string(i);
-         s.resize(digits, '0');
-         return s;
-      }
+   // Returns the enclosing timezone
+   [[nodiscard]] inline auto open_timezone(const ptrdiff_t zone_index) -> size_t {
+      size_t& open = get_open_timezone();
+      const size_t parent = open;
+      if (zone_index != -1)
+         open = static_cast<size_t>(zone_index);
+      return parent;
+   }
 
 
-      [[nodiscard]] inline auto get_num_str(
-         const float_type num,
-         const int significant_digits,
-         const bool with_sign
-      ) -> std::string {
-         std::string s;
-         if (with_sign)
-            s += num < static_cast<float_type>(0.0) ? "-" : "+";
-         const float_type abs_num = std::abs(num);
+   // The thread's open timezone is the parent of zone_index, like for nested
+   // timezones. Plain zones record it when they're checked.
+   inline auto record_parent(
+      const size_t zone_index,
+      const size_t parent
+   ) -> void {
+      if (parent == 0 || parent == zone_index)
+         return;
+      std::atomic<size_t>& recorded = get_thread_total(get_thread_buffer(dt_state), zone_index).parent;
+      if (recorded.load(std::memory_order_relaxed) != parent)
+         recorded.store(parent, std::memory_order_relaxed);
+   }
 
-         {
-            const int whole_rounded = static_cast<int>(std::round(abs_num));
-            const int rounded_predot_digits = auto_get_digits_before_point(whole_rounded);
-            if (rounded_predot_digits >= significant_digits) {
-               s += std::to_string(whole_rounded);
-               return s;
-            }
-         }
+
+   [[nodiscard]] inline auto is_nested_zone_active(const size_t zone_index) -> bool {
+      record_parent(zone_index, get_open_timezone());
+      return is_zone_active(zone_index, dt_state);
+   }
+
+
+   struct ZoneGuard {
+      ZoneGuard(const ptrdiff_t zone_index)
+         : m_parent(open_timezone(zone_index)) // before the clock read, so it isn't measured
+         , m_t0(clock_type::now())
+         , m_zone_index(zone_index)
+      {}
+      ~ZoneGuard() {
+         if (m_zone_index == -1)
+            return;
+         get_open_timezone() = m_parent;
+         record_parent(static_cast<size_t>(m_zone_index), m_parent);
+         const TargetConfig& target = get_target(dt_state);
+         if (target.speedup_zone != 0) {
+            const std::int64_t t1 = clock_type::now();
+            apply_virtual_speedup(dt_state, static_cast<size_t>(m_zone_index), target.speedup_zone, t1 - m_t0 - dt_state.timezone_overhead.load(std::memory_order_relaxed));
+            return;
+         }
+         // only measure during null run
+         if (!is_null_run(target))
+            return;
+         const std::int64_t t1 = clock_type::now();
+         const std::int64_t overhead = dt_state.timezone_overhead.load(std::memory_order_relaxed);
+         ThreadBuffer& buffer = get_thread_buffer(dt_state);
+         // zones shorter than the overhead measure about 0, not less
+         add_to_thread_buffer(buffer, static_cast<size_t>(m_zone_index), std::max<std::int64_t>(t1 - m_t0 - overhead, 0));
+         record_trace_event(dt_state, buffer, static_cast<size_t>(m_zone_index), m_t0, t1);
+      }
+      operator bool() {
+         return m_zone_index == -1 || is_zone_active(static_cast<size_t>(m_zone_index), dt_state);
+      }
+      size_t m_parent;
+      std::int64_t m_t0;
+      const ptrdiff_t m_zone_index;
+   };
+
+
+   // Median of what an empty timezone measures: the part of the clock reads,
+   // branches and loads of the guard that lands between its timestamps. Runs
+   // real guards of the null zone on the calling thread, which record into its
+   // buffer like any other. That's undone afterwards. Needs the null run and
+   // no overhead subtracted yet.
+   [[nodiscard]] inline auto measure_timezone_overhead() -> std::int64_t {
+      constexpr int run_count = 1000;
+      PaddedTotal& total = get_thread_total(get_thread_buffer(dt_state), 0);
+      const std::int64_t value_before = total.value.load(std::memory_order_relaxed);
+      const std::int64_t count_before = total.count.load(std::memory_order_relaxed);
+      const size_t parent_before = total.parent.load(std::memory_order_relaxed);
+      std::vector<std::int64_t> samples(run_count);
+      for (std::int64_t& sample : samples) {
+         const std::int64_t t0 = total.value.load(std::memory_order_relaxed);
+         {
+            const ZoneGuard guard{ 0 };
+         }
+         sample = total.value.load(std::memory_order_relaxed) - t0;
+      }
+      total.value.store(value_before, std::memory_order_relaxed);
+      total.count.store(count_before, std::memory_order_relaxed);
+      total.parent.store(parent_before, std::memory_order_relaxed);
+      std::nth_element(std::begin(samples), std::begin(samples) + run_count / 2, std::end(samples));
+      return samples[run_count / 2];
+   }
+
+
+   [[nodiscard]] inline auto get_zone_index(
+      const std::string& zone_name,
+      const Registry& registry
+   ) -> std::ptrdiff_t {
+      if (registry.names.empty())
+         return -1;
+      // skips the null zone, user zones never map to index 0
+      const auto it = std::find(
+         std::next(std::cbegin(registry.names)),
+         std::cend(registry.names),
+         zone_name
+      );
+      if (it == std::cend(registry.names))
+         return -1;
+      const std::ptrdiff_t index = std::distance(std::cbegin(registry.names), it);
+      return index;
+   }
+
+
+   // 0 if the id isn't in the table
+   [[nodiscard]] inline auto find_in_zone_table(
+      const ZoneId& id,
+      const Registry& registry
+   ) -> size_t {
+      const ZoneTable& table = registry.table;
+      if (table.slots.empty())
+         return 0;
+      const size_t mask = table.slots.size() - 1;
+      for (size_t i = id.hash & mask; table.slots[i].zone_index != 0; i = (i + 1) & mask) {
+         const ZoneTable::Slot& slot = table.slots[i];
+         if (slot.hash != id.hash)
+            continue;
+         // The name is only compared when the literal differs from the one that
+         // created the slot, i.e. for the same name in another translation unit
+         // or on an actual hash collision.
+         if (slot.name == id.name || registry.names[slot.zone_index] == id.name)
+            return slot.zone_index;
+      }
+      return 0;
+   }
+
+
+   inline auto ensure_null_zone(
+      State& state,
+      const Config& pconfig
+   ) -> void {
+      if (state.zones.empty()) {
+         state.zones.emplace_back();
+         state.zones.back().frame_times.reserve(pconfig.target_sample_count);
+      }
+   }
+
+
+   inline auto insert_into_zone_table(
+      ZoneTable& table,
+      const ZoneTable::Slot& new_slot
+   ) -> void {
+      const size_t mask = table.slots.size() - 1;
+      size_t i = new_slot.hash & mask;
+      while (table.slots[i].zone_index != 0)
+         i = (i + 1) & mask;
+      table.slots[i] = new_slot;
+      ++table.used;
+   }
+
+
+   // keeps the load factor at or below 1/2
+   inline auto ensure_zone_table_capacity(ZoneTable& table) -> void {
+      if (2 * (table.used + 1) <= table.slots.size())
+         return;
+      std::vector<ZoneTable::Slot> old_slots = std::move(table.slots);
+      table.slots.assign(std::max<size_t>(16, 2 * old_slots.size()), ZoneTable::Slot{});
+      table.used = 0;
+      for (const ZoneTable::Slot& slot : old_slots) {
+         if (slot.zone_index != 0)
+            insert_into_zone_table(table, slot);
+      }
+   }
+
+
+   // Slow path after a lookup missed. Publishes a new registry with the zone
+   // (and the id, if there is one).
+   [[nodiscard]] inline auto register_zone(
+      const std::string& zone_name,
+      const ZoneId* id,
+      State& state,
+      const Config& pconfig
+   ) -> size_t {
+      const ScopedLock lock(state.mutex);
+      const Registry* current = state.registry.load(std::memory_order_acquire);
+
+      // might have been registered by another thread in the meantime
+      std::ptrdiff_t index = current == nullptr ? -1 : get_zone_index(zone_name, *current);
+      if (index != -1 && (id == nullptr || find_in_zone_table(*id, *current) != 0))
+         return static_cast<size_t>(index);
+
+      auto registry = current == nullptr ? std::make_unique<Registry>() : std::make_unique<Registry>(*current);
+      ensure_null_zone(state, pconfig);
+      if (registry->names.empty())
+         registry->names.emplace_back();
+      if (index == -1) {
+         registry->names.push_back(zone_name);
+         state.zones.emplace_back();
+         state.zones.back().name = zone_name;
+         state.zones.back().frame_times.reserve(pconfig.target_sample_count);
+         index = static_cast<std::ptrdiff_t>(registry->names.size() - 1);
+      }
+      if (id != nullptr) {
+         ensure_zone_table_capacity(registry->table);
+         insert_into_zone_table(registry->table, { id->hash, id->name, static_cast<size_t>(index) });
+      }
+      publish_version(state, state.registry_versions, state.registry, std::move(registry));
+      return static_cast<size_t>(index);
+   }
+
+
+   [[nodiscard]] inline auto get_or_add_zone_index(
+      const std::string& zone_name,
+      State& state,
+      const Config& pconfig
+   ) -> size_t {
+      {
+         const ReadGuard guard(state, get_thread_buffer(state));
+         if (const Registry* registry = state.registry.load()) {
+            const std::ptrdiff_t index = get_zone_index(zone_name, *registry);
+            if (index != -1)
+               return static_cast<size_t>(index);
+         }
+      }
+      return register_zone(zone_name, nullptr, state, pconfig);
+   }
+
+
+   [[nodiscard]] inline auto get_or_add_zone_index(
+      const ZoneId& id,
+      State& state,
+      const Config& pconfig
+   ) -> size_t {
+      {
+         const ReadGuard guard(state, get_thread_buffer(state));
+         if (const Registry* registry = state.registry.load()) {
+            const size_t index = find_in_zone_table(id, *registry);
+            if (index != 0)
+               return index;
+         }
+      }
+      return register_zone(id.name, &id, state, pconfig);
+   }
+
+
+   // Variants and workloads are registered like zones, each in their own list
+   using NameList = std::vector<std::string> Registry::*;
+
+
+   [[nodiscard]] inline auto get_name_index(
+      const std::string& name,
+      const Registry& registry,
+      const NameList list
+   ) -> std::ptrdiff_t {
+      const std::vector<std::string>& names = registry.*list;
+      const auto it = std::find(std::cbegin(names), std::cend(names), name);
+      if (it == std::cend(names))
+         return -1;
+      return std::distance(std::cbegin(names), it);
+   }
+
+
+   // on_add() is called with the mutex locked when the name is new
+   template<class OnAdd>
+   [[nodiscard]] inline auto get_or_add_name_index(
+      const std::string& name,
+      const NameList list,
+      State& state,
+      const Config& pconfig,
+      OnAdd&& on_add
+   ) -> size_t {
+      {
+         const ReadGuard guard(state, get_thread_buffer(state));
+         if (const Registry* registry = state.registry.load()) {
+            const std::ptrdiff_t index = get_name_index(name, *registry, list);
+            if (index != -1)
+               return static_cast<size_t>(index);
+         }
+      }
+
+      const ScopedLock lock(state.mutex);
+      const Registry* current = state.registry.load(std::memory_order_acquire);
+      if (current != nullptr) { // might have been registered by another thread in the meantime
+         const std::ptrdiff_t index = get_name_index(name, *current, list);
+         if (index != -1)
+            return static_cast<size_t>(index);
+      }
+
+      auto registry = current == nullptr ? std::make_unique<Registry>() : std::make_unique<Registry>(*current);
+      ensure_null_zone(state, pconfig);
+      if (registry->names.empty())
+         registry->names.emplace_back();
+      (*registry.*list).push_back(name);
+      const size_t index = (*registry.*list).size() - 1;
+      on_add();
+      publish_version(state, state.registry_versions, state.registry, std::move(registry));
+      return index;
+   }
+
+
+   [[nodiscard]] inline auto get_or_add_variant_index(
+      const std::string& variant_name,
+      const int variant_count,
+      State& state,
+      const Config& pconfig
+   ) -> size_t {
+      return get_or_add_name_index(variant_name, &Registry::variant_names, state, pconfig, [&]() {
+         state.variants.push_back({ variant_name, variant_count });
+      });
+   }
+
+
+   [[nodiscard]] inline auto get_or_add_workload_index(
+      const std::string& workload_name,
+      State& state,
+      const Config& pconfig
+   ) -> size_t {
+      return get_or_add_name_index(workload_name, &Registry::workload_names, state, pconfig, [&]() {
+         state.workloads.push_back(workload_name);
+      });
+   }
+
+
+   [[nodiscard]] inline auto get_zone_guard(
+      const size_t zone_index,
+      const State& state
+   ) -> ZoneGuard {
+      if (state.status.load(std::memory_order_relaxed) != Status::Measuring)
+         return ZoneGuard{ -1 };
+      return ZoneGuard{ static_cast<ptrdiff_t>(zone_index) };
+   }
+
+
+   // Two-sided 95% quantile of Student's t-distribution (Cornish-Fisher
+   // expansion around the normal one). Good to ~1e-3 from 5 degrees of freedom.
+   [[nodiscard]] inline auto get_t_quantile_95(const double degrees_of_freedom) -> double {
+      constexpr double z = 1.959963985;
+      const double df = std::max(degrees_of_freedom, 1.0);
+      const double z3 = z * z * z;
+      const double z5 = z3 * z * z;
+      return z + (z3 + z) / (4.0 * df) + (5.0 * z5 + 16.0 * z3 + 3.0 * z) / (96.0 * df * df);
+   }
+
+
+#if defined(DT_SIMD_AVX)
+   [[nodiscard]] inline auto load_as_doubles(const float_type* values) -> __m256d {
+      if constexpr (std::is_same_v<float_type, float>)
+         return _mm256_cvtps_pd(_mm_loadu_ps(reinterpret_cast<const float*>(values)));
+      else
+         return _mm256_loadu_pd(reinterpret_cast<const double*>(values));
+   }
+#elif defined(DT_SIMD_SSE2)
+   [[nodiscard]] inline auto load_as_doubles(const float_type* values) -> __m128d {
+      if constexpr (std::is_same_v<float_type, float>)
+         return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(values))));
+      else
+         return _mm_loadu_pd(reinterpret_cast<const double*>(values));
+   }
+#endif
+
+
+   // Sum of (value - offset)^power, power 1 or 2. Always accumulates in
+   // double, in several lanes.
+   template<int power>
+   [[nodiscard]] inline auto get_power_sum(
+      const float_type* values,
+      const size_t n,
+      const double offset
+   ) -> double {
+      static_assert(power == 1 || power == 2);
+      size_t i = 0;
+      double sum = 0.0;
+#if defined(DT_SIMD_AVX)
+      const __m256d offsets = _mm256_set1_pd(offset);
+      __m256d acc0 = _mm256_setzero_pd();
+      __m256d acc1 = _mm256_setzero_pd();
+      for (; i + 8 <= n; i += 8) {
+         __m256d a = _mm256_sub_pd(load_as_doubles(values + i), offsets);
+         __m256d b = _mm256_sub_pd(load_as_doubles(values + i + 4), offsets);
+         if constexpr (power == 2) {
+            a = _mm256_mul_pd(a, a);
+            b = _mm256_mul_pd(b, b);
+         }
+         acc0 = _mm256_add_pd(acc0, a);
+         acc1 = _mm256_add_pd(acc1, b);
+      }
+      alignas(32) double lanes[4];
+      _mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+      sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(DT_SIMD_SSE2)
+      const __m128d offsets = _mm_set1_pd(offset);
+      __m128d acc0 = _mm_setzero_pd();
+      __m128d acc1 = _mm_setzero_pd();
+      for (; i + 4 <= n; i += 4) {
+         __m128d a = _mm_sub_pd(load_as_doubles(values + i), offsets);
+         __m128d b = _mm_sub_pd(load_as_doubles(values + i + 2), offsets);
+         if constexpr (power == 2) {
+            a = _mm_mul_pd(a, a);
+            b = _mm_mul_pd(b, b);
+         }
+         acc0 = _mm_add_pd(acc0, a);
+         acc1 = _mm_add_pd(acc1, b);
+      }
+      alignas(16) double lanes[2];
+      _mm_store_pd(lanes, _mm_add_pd(acc0, acc1));
+      sum = lanes[0] + lanes[1];
+#endif
+      for (; i < n; ++i) {
+         const double d = static_cast<double>(values[i]) - offset;
+         sum += power == 2 ? d * d : d;
+      }
+      return sum;
+   }
+
+
+   // Small enough for the L1 cache
+   constexpr size_t stats_block_size = 1024;
+
+   struct Moments {
+      size_t count = 0;
+      double mean = 0.0;
+      double m2 = 0.0; // sum of squared deviations from the mean
+   };
+
+
+   // Mean and squared deviations with one pass over memory: each block is
+   // read twice while it's cached, and the blocks are merged with Chan's
+   // formula, which is as stable as Welford's.
+   [[nodiscard]] inline auto get_moments(const std::vector<float_type>& vec) -> Moments {
+      Moments total;
+      for (size_t begin = 0; begin < vec.size(); begin += stats_block_size) {
+         const size_t n = std::min(stats_block_size, vec.size() - begin);
+         const float_type* block = vec.data() + begin;
+         const double block_mean = get_power_sum<1>(block, n, 0.0) / static_cast<double>(n);
+         const double block_m2 = get_power_sum<2>(block, n, block_mean);
+
+         const double count = static_cast<double>(total.count + n);
+         const double delta = block_mean - total.mean;
+         total.mean += delta * static_cast<double>(n) / count;
+         total.m2 += block_m2 + delta * delta * static_cast<double>(total.count) * static_cast<double>(n) / count;
+         total.count += n;
+      }
+      return total;
+   }
+
+
+   [[nodiscard]] inline auto get_frame_tick_variance(const Zone& zone) -> double {
+      const size_t n = zone.frame_count;
+      return n < 2 ? 0.0 : zone.frame_tick_m2 / static_cast<double>(n - 1);
+   }
+
+
+   // Width of the 95% CI of the mean frame time difference to the baseline
+   // (Welch), relative to the baseline mean. For the baseline itself, that's
+   // the width of its own mean CI times sqrt(2), so that it contributes at
+   // most half the variance of the differences.
+   [[nodiscard]] inline auto get_relative_ci_width(
+      const Zone& baseline,
+      const Zone& zone,
+      const bool is_baseline
+   ) -> double {
+      const double n0 = static_cast<double>(baseline.frame_count);
+      if (baseline.frame_count < 2 || baseline.frame_tick_mean <= 0.0)
+         return std::numeric_limits<double>::infinity();
+      const double v0 = get_frame_tick_variance(baseline) / n0;
+      if (is_baseline)
+         return std::sqrt(2.0) * 2.0 * get_t_quantile_95(n0 - 1.0) * std::sqrt(v0) / baseline.frame_tick_mean;
+
+      const double n1 = static_cast<double>(zone.frame_count);
+      if (zone.frame_count < 2)
+         return std::numeric_limits<double>::infinity();
+      const double v1 = get_frame_tick_variance(zone) / n1;
+      const double v = v0 + v1;
+      if (v <= 0.0)
+         return 0.0;
+      const double df = v * v / (v0 * v0 / (n0 - 1.0) + v1 * v1 / (n1 - 1.0));
+      return 2.0 * get_t_quantile_95(df) * std::sqrt(v) / baseline.frame_tick_mean;
+   }
+
+
+   // Zones first, then the combinations, the virtual speedups, the variant
+   // alternatives and the workload points. Those are offset so that zones
+   // registered during a measurement don't shift them.
+   constexpr size_t combination_config_offset = std::numeric_limits<size_t>::max() / 2 + 1;
+   constexpr size_t speedup_config_offset = combination_config_offset + combination_config_offset / 2;
+   constexpr size_t variant_config_offset = speedup_config_offset + combination_config_offset / 4;
+   constexpr size_t workload_config_offset = variant_config_offset + combination_config_offset / 8;
+
+
+   struct ConfigRange {
+      size_t offset;
+      size_t count;
+   };
+
+
+   // In scheduling order
+   [[nodiscard]] inline auto get_config_ranges(const State& state) -> std::array<ConfigRange, 5> {
+      return { {
+         { 0, state.zones.size() },
+         { combination_config_offset, state.combinations.size() },
+         { speedup_config_offset, state.speedups.size() },
+         { variant_config_offset, state.alternatives.size() },
+         { workload_config_offset, state.workload_points.size() }
+      } };
+   }
+
+
+   [[nodiscard]] inline auto get_record(
+      const State& state,
+      const size_t config_index
+   ) -> const Zone& {
+      if (config_index >= workload_config_offset)
+         return state.workload_points[config_index - workload_config_offset].record;
+      if (config_index >= variant_config_offset)
+         return state.alternatives[config_index - variant_config_offset].record;
+      if (config_index >= speedup_config_offset)
+         return state.speedups[config_index - speedup_config_offset].record;
+      if (config_index >= combination_config_offset)
+         return state.combinations[config_index - combination_config_offset].record;
+      return state.zones[config_index];
+   }
+
+
+   [[nodiscard]] inline auto get_record(
+      State& state,
+      const size_t config_index
+   ) -> Zone& {
+      return const_cast<Zone&>(get_record(static_cast<const State&>(state), config_index));
+   }
+
+
+   [[nodiscard]] inline auto get_target_config(
+      const State& state,
+      const size_t config_index
+   ) -> TargetConfig {
+      TargetConfig target;
+      if (config_index >= workload_config_offset) {
+         const WorkloadPoint& point = state.workload_points[config_index - workload_config_offset];
+         target.target_workload = point.workload + 1;
+         target.workload_fraction = point.fraction;
+      }
+      else if (config_index >= variant_config_offset) {
+         const Alternative& alternative = state.alternatives[config_index - variant_config_offset];
+         target.target_variant = alternative.variant + 1;
+         target.variant_choice = alternative.choice;
+      }
+      else if (config_index >= speedup_config_offset)
+         target.speedup_zone = state.speedups[config_index - speedup_config_offset].zone;
+      else if (config_index >= combination_config_offset)
+         target.disabled_mask = state.combinations[config_index - combination_config_offset].disabled_mask;
+      else
+         target.target_zone = config_index;
+      return target;
+   }
+
+
+   [[nodiscard]] inline auto is_same_target(
+      const TargetConfig& a,
+      const TargetConfig& b
+   ) -> bool {
+      return a.target_zone == b.target_zone
+         && a.disabled_mask == b.disabled_mask
+         && a.speedup_zone == b.speedup_zone
+         && a.target_variant == b.target_variant
+         && a.variant_choice == b.variant_choice
+         && a.target_workload == b.target_workload
+         && a.workload_fraction == b.workload_fraction;
+   }
+
+
+   // Zone checks may hold a snapshot for as long as their thread is preempted,
+   // so they're never changed or freed until factory_reset(). There's one per
+   // configuration of the measurement, made the first time it's targeted and
+   // shared with equal ones of earlier measurements.
+   [[nodiscard]] inline auto get_target_snapshot(
+      State& state,
+      const size_t config_index
+   ) -> const TargetConfig* {
+      const std::array<ConfigRange, 5> ranges = get_config_ranges(state);
+      size_t r = ranges.size() - 1;
+      while (config_index < ranges[r].offset)
+         --r;
+      std::vector<const TargetConfig*>& targets = state.config_targets[r];
+      const size_t i = config_index - ranges[r].offset;
+      if (i >= targets.size())
+         targets.resize(i + 1, nullptr);
+      if (targets[i] != nullptr)
+         return targets[i];
+
+      const TargetConfig target = get_target_config(state, config_index);
+      if (is_same_target(target, null_target_config))
+         return targets[i] = &null_target_config;
+      for (const std::unique_ptr<TargetConfig>& snapshot : state.target_snapshots) {
+         if (is_same_target(target, *snapshot))
+            return targets[i] = snapshot.get();
+      }
+      state.target_snapshots.emplace_back(std::make_unique<TargetConfig>(target));
+      return targets[i] = state.target_snapshots.back().get();
+   }
+
+
+   inline auto set_target_config(
+      State& state,
+      const size_t config_index
+   ) -> void {
+      state.target_config = config_index;
+      state.target.store(get_target_snapshot(state, config_index), std::memory_order_release);
+      // delays that weren't waited for don't carry over into other configurations
+      const std::int64_t speedup_delay = state.speedup_delay.load();
+      for (const std::unique_ptr<ThreadBuffer>& buffer : state.thread_buffers)
+         buffer->paid_delay = speedup_delay;
+   }
+
+
+   [[nodiscard]] inline auto needs_more_samples(
+      const State& state,
+      const Config& pconfig,
+      const size_t config_index
+   ) -> bool {
+      const Zone& record = get_record(state, config_index);
+      const int n = static_cast<int>(record.frame_count);
+      if (pconfig.target_ci_width <= static_cast<float_type>(0.0))
+         return n < pconfig.target_sample_count;
+      if (n < pconfig.min_sample_count)
+         return true;
+      if (n >= pconfig.max_sample_count)
+         return false;
+      return get_relative_ci_width(state.zones[0], record, config_index == 0) > pconfig.target_ci_width;
+   }
+
+
+   [[nodiscard]] inline auto is_block_done(
+      const State& state,
+      const Config& pconfig
+   ) -> bool {
+      return state.recorded_slices >= state.block_size || !needs_more_samples(state, pconfig, state.target_config);
+   }
+
+
+   [[nodiscard]] inline auto are_all_configs_done(const State& state) -> bool {
+      const ConfigRange last = get_config_ranges(state).back();
+      return state.target_config >= last.offset + last.count;
+   }
+
+
+   // splitmix64, plenty for shuffling
+   [[nodiscard]] inline auto get_random(std::uint64_t& rng_state) -> std::uint64_t {
+      std::uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+   }
+
+
+   [[nodiscard]] inline auto get_random_below(
+      std::uint64_t& rng_state,
+      const size_t n
+   ) -> size_t {
+      return static_cast<size_t>(get_random(rng_state) % n);
+   }
+
+
+   // in [0, 1)
+   [[nodiscard]] inline auto get_random_unit(std::uint64_t& rng_state) -> double {
+      return static_cast<double>(get_random(rng_state) >> 11) * (1.0 / 9007199254740992.0);
+   }
+
+
+   // Box-Muller
+   [[nodiscard]] inline auto get_random_normal(std::uint64_t& rng_state) -> double {
+      const double u1 = 1.0 - get_random_unit(rng_state);
+      const double u2 = get_random_unit(rng_state);
+      return std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+   }
+
+
+   // Marsaglia-Tsang, shape must be >= 1
+   [[nodiscard]] inline auto get_random_gamma(
+      std::uint64_t& rng_state,
+      const double shape
+   ) -> double {
+      const double d = shape - 1.0 / 3.0;
+      const double c = 1.0 / std::sqrt(9.0 * d);
+      while (true) {
+         double x, v;
+         do {
+            x = get_random_normal(rng_state);
+            v = 1.0 + c * x;
+         } while (v <= 0.0);
+         v = v * v * v;
+         const double u = get_random_unit(rng_state);
+         if (u < 1.0 - 0.0331 * x * x * x * x)
+            return d * v;
+         if (std::log(u) < 0.5 * x * x + d * (1.0 - v + std::log(v)))
+            return d * v;
+      }
+   }
+
+
+   [[nodiscard]] inline auto get_random_beta(
+      std::uint64_t& rng_state,
+      const double a,
+      const double b
+   ) -> double {
+      const double x = get_random_gamma(rng_state, a);
+      const double y = get_random_gamma(rng_state, b);
+      return x / (x + y);
+   }
+
+
+   // Median of a bootstrap resample of sorted_vec, without resampling: the
+   // k-th order statistic of n uniforms is Beta(k, n-k+1) distributed, and the
+   // resample's order statistics are the sample quantiles at those uniforms.
+   // O(1) instead of O(n) per resample, and exact.
+   [[nodiscard]] inline auto get_bootstrap_median(
+      const std::vector<float_type>& sorted_vec,
+      std::uint64_t& rng_state
+   ) -> float_type {
+      const size_t n = sorted_vec.size();
+      if (n == 0)
+         return static_cast<float_type>(0.0);
+      const auto get_quantile = [&](const double u) {
+         return sorted_vec[std::min(n - 1, static_cast<size_t>(u * static_cast<double>(n)))];
+      };
+      const size_t k = (n + 1) / 2;
+      const double u1 = get_random_beta(rng_state, static_cast<double>(k), static_cast<double>(n - k + 1));
+      if (n % 2 == 1)
+         return get_quantile(u1);
+      // the next order statistic is the minimum of the n-k uniforms above u1
+      const double u2 = u1 + (1.0 - u1) * (1.0 - std::pow(get_random_unit(rng_state), 1.0 / static_cast<double>(n - k)));
+      return static_cast<float_type>(0.5) * (get_quantile(u1) + get_quantile(u2));
+   }
+
+
+   // 95% percentile bootstrap CI of median(sorted_vec) - median(sorted_baseline).
+   // Only the middle of the vectors needs to be sorted, see select_evaluated_ranks().
+   inline auto get_bootstrap_median_diff_ci(
+      const std::vector<float_type>& sorted_vec,
+      const std::vector<float_type>& sorted_baseline,
+      const int resamples,
+      std::uint64_t& rng_state,
+      float_type& ci_low,
+      float_type& ci_high
+   ) -> void {
+      ci_low = ci_high = static_cast<float_type>(0.0);
+      if (resamples <= 0 || sorted_vec.empty() || sorted_baseline.empty())
+         return;
+      std::vector<float_type> diffs(resamples);
+      for (float_type& diff : diffs)
+         diff = get_bootstrap_median(sorted_vec, rng_state) - get_bootstrap_median(sorted_baseline, rng_state);
+      std::sort(std::begin(diffs), std::end(diffs));
+      ci_low = diffs[static_cast<size_t>(0.025 * (resamples - 1) + 0.5)];
+      ci_high = diffs[static_cast<size_t>(0.975 * (resamples - 1) + 0.5)];
+   }
+
+
+   // Continued fraction of the regularized incomplete beta function (modified
+   // Lentz), converges quickly for x < (a+1)/(a+b+2)
+   [[nodiscard]] inline auto get_incomplete_beta_cf(
+      const double a,
+      const double b,
+      const double x
+   ) -> double {
+      constexpr double tiny = 1e-300;
+      const auto clamp_tiny = [](const double v) { return std::abs(v) < tiny ? tiny : v; };
+      double c = 1.0;
+      double d = 1.0 / clamp_tiny(1.0 - (a + b) * x / (a + 1.0));
+      double h = d;
+      for (int m = 1; m <= 300; ++m) {
+         const double m2 = 2.0 * m;
+         const double even = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2));
+         d = 1.0 / clamp_tiny(1.0 + even * d);
+         c = clamp_tiny(1.0 + even / c);
+         h *= d * c;
+         const double odd = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0));
+         d = 1.0 / clamp_tiny(1.0 + odd * d);
+         c = clamp_tiny(1.0 + odd / c);
+         const double step = d * c;
+         h *= step;
+         if (std::abs(step - 1.0) < 1e-12)
+            break;
+      }
+      return h;
+   }
+
+
+   [[nodiscard]] inline auto get_incomplete_beta(
+      const double a,
+      const double b,
+      const double x
+   ) -> double {
+      if (x <= 0.0)
+         return 0.0;
+      if (x >= 1.0)
+         return 1.0;
+      const double log_front = std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1.0 - x);
+      if (x < (a + 1.0) / (a + b + 2.0))
+         return std::exp(log_front) * get_incomplete_beta_cf(a, b, x) / a;
+      return 1.0 - std::exp(log_front) * get_incomplete_beta_cf(b, a, 1.0 - x) / b;
+   }
+
+
+   // Two-sided p-value of Welch's t-test from the means and (bessel-corrected)
+   // variances of both samples
+   [[nodiscard]] inline auto get_welch_p_value(
+      const double mean1,
+      const double variance1,
+      const double n1,
+      const double mean2,
+      const double variance2,
+      const double n2
+   ) -> double {
+      if (n1 < 2.0 || n2 < 2.0)
+         return 1.0;
+      const double v1 = variance1 / n1;
+      const double v2 = variance2 / n2;
+      const double v = v1 + v2;
+      if (v <= 0.0)
+         return mean1 == mean2 ? 1.0 : 0.0;
+      const double t = (mean1 - mean2) / std::sqrt(v);
+      const double df = v * v / (v1 * v1 / (n1 - 1.0) + v2 * v2 / (n2 - 1.0));
+      return get_incomplete_beta(0.5 * df, 0.5, df / (df + t * t));
+   }
+
+
+   [[nodiscard]] inline auto get_welch_p_value(
+      const std::vector<float_type>& a,
+      const std::vector<float_type>& b
+   ) -> double {
+      if (a.size() < 2 || b.size() < 2)
+         return 1.0;
+      const Moments m1 = get_moments(a);
+      const Moments m2 = get_moments(b);
+      const double n1 = static_cast<double>(m1.count);
+      const double n2 = static_cast<double>(m2.count);
+      return get_welch_p_value(m1.mean, m1.m2 / (n1 - 1.0), n1, m2.mean, m2.m2 / (n2 - 1.0), n2);
+   }
+
+
+   // Two-sided p-value of the Mann-Whitney U test, normal approximation with
+   // tie and continuity correction. Ranks come from merging the sorted inputs.
+   [[nodiscard]] inline auto get_mann_whitney_p_value(
+      const std::vector<float_type>& sorted_a,
+      const std::vector<float_type>& sorted_b
+   ) -> double {
+      const size_t n1 = sorted_a.size();
+      const size_t n2 = sorted_b.size();
+      if (n1 == 0 || n2 == 0)
+         return 1.0;
+      double rank_sum_a = 0.0;
+      double tie_term = 0.0; // sum of t^3 - t over tie groups
+      size_t i = 0, j = 0;
+      while (i < n1 || j < n2) {
+         const float_type value = (j == n2 || (i < n1 && sorted_a[i] <= sorted_b[j])) ? sorted_a[i] : sorted_b[j];
+         size_t count_a = 0, count_b = 0;
+         while (i < n1 && sorted_a[i] == value) {
+            ++count_a;
+            ++i;
+         }
+         while (j < n2 && sorted_b[j] == value) {
+            ++count_b;
+            ++j;
+         }
+         const double first_rank = static_cast<double>(i + j - count_a - count_b + 1);
+         const double tie_count = static_cast<double>(count_a + count_b);
+         rank_sum_a += count_a * (first_rank + 0.5 * (tie_count - 1.0));
+         tie_term += tie_count * tie_count * tie_count - tie_count;
+      }
+      const double n = static_cast<double>(n1 + n2);
+      const double u = rank_sum_a - 0.5 * n1 * (n1 + 1.0);
+      const double mean_u = 0.5 * n1 * n2;
+      const double var_u = n1 * n2 / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+      if (var_u <= 0.0)
+         return 1.0;
+      const double z = std::max(0.0, std::abs(u - mean_u) - 0.5) / std::sqrt(var_u);
+      return std::erfc(z / std::sqrt(2.0));
+   }
+
+
+   // Every zone configuration that still needs samples once, in random order
+   inline auto start_interleaved_round(
+      State& state,
+      const Config& pconfig
+   ) -> void {
+      state.schedule.clear();
+      for (const ConfigRange& range : get_config_ranges(state)) {
+         for (size_t i = 0; i < range.count; ++i) {
+            if (needs_more_samples(state, pconfig, range.offset + i))
+               state.schedule.emplace_back(range.offset + i);
+         }
+      }
+      for (size_t i = state.schedule.size(); i > 1; --i) // Fisher-Yates
+         std::swap(state.schedule[i - 1], state.schedule[get_random_below(state.rng_state, i)]);
+      state.schedule_pos = 0;
+   }
+
+
+   // false when all zones have their samples
+   [[nodiscard]] inline auto start_next_interleaved_block(
+      State& state,
+      const Config& pconfig
+   ) -> bool {
+      if (state.schedule_pos >= state.schedule.size()) {
+         start_interleaved_round(state, pconfig);
+         if (state.schedule.empty())
+            return false;
+      }
+      const size_t next_config = state.schedule[state.schedule_pos++];
+      state.block_size = 1 + static_cast<int>(get_random_below(state.rng_state, std::max(1, pconfig.interleave_block_size)));
+      state.recorded_slices = 0;
+      if (next_config != state.target_config)
+         state.warmup_runs_left = pconfig.switch_warmup_runs;
+      set_target_config(state, next_config);
+      return true;
+   }
+
+
+   // false when all zones have their samples
+   [[nodiscard]] inline auto start_next_block(
+      State& state,
+      const Config& pconfig
+   ) -> bool {
+      if (pconfig.schedule_mode == ScheduleMode::Interleaved)
+         return start_next_interleaved_block(state, pconfig);
+      size_t next_config = state.target_config + 1;
+      const std::array<ConfigRange, 5> ranges = get_config_ranges(state);
+      for (size_t r = 0; r + 1 < ranges.size(); ++r) {
+         if (next_config == ranges[r].offset + ranges[r].count)
+            next_config = ranges[r + 1].offset;
+      }
+      state.recorded_slices = 0;
+      state.warmup_runs_left = pconfig.warmup_runs;
+      state.target_config = next_config;
+      if (are_all_configs_done(state))
+         return false;
+      set_target_config(state, next_config);
+      return true;
+   }
+
+
+   inline auto start_first_block(
+      State& state,
+      const Config& pconfig
+   ) -> void {
+      state.block_size = std::numeric_limits<int>::max(); // blocks end by sample count
+      if (pconfig.schedule_mode == ScheduleMode::Interleaved) {
+         start_interleaved_round(state, pconfig);
+         (void)start_next_interleaved_block(state, pconfig);
+      }
+      state.warmup_runs_left = pconfig.warmup_runs;
+   }
+
+
+   // Only zones 1 to 63 fit in the mask
+   [[nodiscard]] inline auto get_pairwise_zone_limit(const Config& pconfig) -> size_t {
+      return std::min<size_t>(pconfig.max_pairwise_zones, 63);
+   }
+
+
+   // All pairs of the first zones, see Config::max_pairwise_zones
+   inline auto add_pairwise_combinations(
+      State& state,
+      const Config& pconfig
+   ) -> void {
+      const size_t zone_count = std::min<size_t>(state.zones.size(), get_pairwise_zone_limit(pconfig) + 1);
+      for (size_t a = 1; a < zone_count; ++a) {
+         for (size_t b = a + 1; b < zone_count; ++b) {
+            Combination combination;
+            combination.disabled_mask = (std::uint64_t(1) << a) | (std::uint64_t(1) << b);
+            combination.record.name = state.zones[a].name + " & " + state.zones[b].name;
+            state.combinations.emplace_back(std::move(combination));
+         }
+      }
+   }
+
+
+   // A zone can't be sped up by nothing, all of its time or more. Those count
+   // as disabled.
+   [[nodiscard]] inline auto get_virtual_speedup(const Config& pconfig) -> float_type {
+      const float_type speedup = pconfig.virtual_speedup;
+      if (speedup > static_cast<float_type>(0.0) && speedup < static_cast<float_type>(1.0))
+         return speedup;
+      return static_cast<float_type>(0.0);
+   }
+
+
+   // One record per zone, added once a timezone of it closed. A plain
+   // dt::zone() inserts no delays, its record would only measure the baseline
+   // again. See Config::virtual_speedup.
+   inline auto add_speedups(State& state) -> void {
+      state.sped_up_zones.resize(state.zones.size(), false);
+      for (size_t i = 1; i < state.zones.size(); ++i) {
+         if (state.sped_up_zones[i] || state.zones[i].zone_buffer_count == 0)
+            continue;
+         state.sped_up_zones[i] = true;
+         Speedup speedup;
+         speedup.zone = i;
+         speedup.record.name = state.zones[i].name;
+         state.speedups.emplace_back(std::move(speedup));
+      }
+   }
+
+
+   // Every variant but the default 0 of each dt::variant()
+   inline auto add_alternatives(State& state) -> void {
+      for (size_t v = 0; v < state.variants.size(); ++v) {
+         for (int choice = 1; choice < state.variants[v].count; ++choice) {
+            Alternative alternative;
+            alternative.variant = v;
+            alternative.choice = choice;
+            alternative.record.name = state.variants[v].name + " #" + std::to_string(choice);
+            state.alternatives.emplace_back(std::move(alternative));
+         }
+      }
+   }
+
+
+   // The ones in [0, 1) without duplicates. 1 is already the baseline.
+   [[nodiscard]] inline auto get_valid_workload_fractions(const std::vector<float_type>& fractions) -> std::vector<float_type> {
+      std::vector<float_type> valid;
+      for (const float_type fraction : fractions) {
+         if (fraction < static_cast<float_type>(0.0) || fraction >= static_cast<float_type>(1.0))
+            continue;
+         if (std::find(std::begin(valid), std::end(valid), fraction) == std::end(valid))
+            valid.emplace_back(fraction);
+      }
+      return valid;
+   }
+
+
+   inline auto add_workload_points(
+      State& state,
+      const Config& pconfig
+   ) -> void {
+      const std::vector<float_type> fractions = get_valid_workload_fractions(pconfig.workload_fractions);
+      for (size_t w = 0; w < state.workloads.size(); ++w) {
+         for (const float_type fraction : fractions) {
+            WorkloadPoint point;
+            point.workload = w;
+            point.fraction = fraction;
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), " x%g", static_cast<double>(fraction));
+            point.record.name = state.workloads[w] + buffer;
+            state.workload_points.emplace_back(std::move(point));
+         }
+      }
+   }
+
+
+   // doesn't touch zone names, status or t0
+   inline auto reset_state(State& state) -> void {
+      for (std::vector<const TargetConfig*>& targets : state.config_targets)
+         targets.clear();
+      state.combinations.clear();
+      state.speedups.clear();
+      state.sped_up_zones.clear();
+      state.alternatives.clear();
+      state.workload_points.clear();
+      set_target_config(state, 0);
+      state.recorded_slices = 0;
+      state.warmup_runs_left = config.warmup_runs;
+      state.schedule.clear();
+      state.schedule_pos = 0;
+      for (Zone& zone : state.zones) {
+         zone.frame_times.clear();
+         zone.frame_sketch = QuantileSketch{};
+         zone.frame_count = 0;
+         zone.frame_tick_mean = 0.0;
+         zone.frame_tick_m2 = 0.0;
+         zone.zone_times.clear();
+         zone.zone_sketch = QuantileSketch{};
+         zone.zone_count = 0;
+         zone.thread_zone_sums.clear();
+      }
+   }
+
+
+   // fun fact: median means mean of middle elements for even sizes
+   [[nodiscard]] inline auto get_median(std::vector<float_type>& sorted_vec) -> float_type {
+      if (sorted_vec.empty()) // ask stupid questions, get stupid answers
+         return 0.0;
+      if (sorted_vec.size() % 2 == 0) { // even size
+         const size_t i_middle_left = sorted_vec.size() / 2 - 1;
+         return static_cast<float_type>(0.5)* (sorted_vec[i_middle_left] + sorted_vec[i_middle_left + 1]);
+      }
+      else { // odd size
+         const size_t i_middle = sorted_vec.size() / 2;
+         return sorted_vec[i_middle];
+      }
+   }
+
+
+   // Summed blockwise in double, see get_power_sum()
+   [[nodiscard]] inline auto get_mean(const std::vector<float_type>& vec) -> float_type {
+      double sum = 0.0;
+      for (size_t begin = 0; begin < vec.size(); begin += stats_block_size)
+         sum += get_power_sum<1>(vec.data() + begin, std::min(stats_block_size, vec.size() - begin), 0.0);
+      return static_cast<float_type>(sum / vec.size());
+   }
+
+
+   // This is bessel-corrected!
+   [[nodiscard]] inline auto get_std_dev(
+      const std::vector<float_type>& vec,
+      const float_type mean
+   ) -> float_type {
+      double squares = 0.0;
+      for (size_t begin = 0; begin < vec.size(); begin += stats_block_size)
+         squares += get_power_sum<2>(vec.data() + begin, std::min(stats_block_size, vec.size() - begin), mean);
+      return static_cast<float_type>(std::sqrt(squares / (vec.size() - 1.0)));
+   }
+
+
+   [[nodiscard]] inline auto get_ms_from_ticks(
+      const std::vector<std::int64_t>& ticks,
+      const double ms_per_tick
+   ) -> std::vector<float_type> {
+      std::vector<float_type> ms;
+      ms.reserve(ticks.size());
+      for (const std::int64_t value : ticks)
+         ms.emplace_back(get_ms_from_ticks(value, ms_per_tick));
+      return ms;
+   }
+
+
+   // Linear interpolation between the closest ranks, percentile in [0, 100]
+   [[nodiscard]] inline auto get_percentile(
+      const std::vector<float_type>& sorted_vec,
+      const float_type percentile
+   ) -> float_type {
+      if (sorted_vec.empty())
+         return static_cast<float_type>(0.0);
+      const float_type rank = std::clamp(percentile, static_cast<float_type>(0.0), static_cast<float_type>(100.0)) / static_cast<float_type>(100.0) * (sorted_vec.size() - 1);
+      const size_t lower = static_cast<size_t>(rank);
+      if (lower + 1 >= sorted_vec.size())
+         return sorted_vec.back();
+      const float_type fraction = rank - static_cast<float_type>(lower);
+      return sorted_vec[lower] + fraction * (sorted_vec[lower + 1] - sorted_vec[lower]);
+   }
+
+
+   constexpr size_t max_sketch_buckets = 2048;
+
+
+   // Moves the buckets so that they start at new_min_index with new_size
+   // buckets. Buckets below new_min_index are collapsed into the lowest one.
+   inline auto rebase_sketch(
+      QuantileSketch& sketch,
+      const int new_min_index,
+      const size_t new_size
+   ) -> void {
+      std::vector<std::int64_t> counts(new_size, 0);
+      for (size_t i = 0; i < sketch.counts.size(); ++i) {
+         const int index = std::max(sketch.min_index + static_cast<int>(i), new_min_index);
+         counts[index - new_min_index] += sketch.counts[i];
+      }
+      sketch.counts = std::move(counts);
+      sketch.min_index = new_min_index;
+   }
+
+
+   // Constant time, apart from the rare growth of the bucket range
+   inline auto add_to_sketch(
+      QuantileSketch& sketch,
+      const std::int64_t value,
+      const double log_gamma
+   ) -> void {
+      if (sketch.count == 0) {
+         sketch.log_gamma = log_gamma;
+         sketch.min_value = value;
+         sketch.max_value = value;
+      }
+      sketch.min_value = std::min(sketch.min_value, value);
+      sketch.max_value = std::max(sketch.max_value, value);
+      ++sketch.count;
+      if (value <= 0) {
+         ++sketch.zero_count;
+         return;
+      }
+      const int index = static_cast<int>(std::ceil(std::log(static_cast<double>(value)) / sketch.log_gamma));
+      if (sketch.counts.empty()) {
+         sketch.counts.assign(1, 0);
+         sketch.min_index = index;
+      }
+      const int max_index = sketch.min_index + static_cast<int>(sketch.counts.size()) - 1;
+      if (index < sketch.min_index) {
+         const size_t new_size = static_cast<size_t>(max_index - index) + 1;
+         if (new_size > max_sketch_buckets) {
+            ++sketch.counts.front(); // collapsed into the lowest bucket
+            return;
+         }
+         rebase_sketch(sketch, index, new_size);
+      }
+      else if (index > max_index) {
+         const size_t new_size = std::min(static_cast<size_t>(index - sketch.min_index) + 1, max_sketch_buckets);
+         rebase_sketch(sketch, index - static_cast<int>(new_size) + 1, new_size);
+      }
+      ++sketch.counts[index - sketch.min_index];
+   }
+
+
+   // quantile in [0, 1]. Returns ticks.
+   [[nodiscard]] inline auto get_sketch_quantile(
+      const QuantileSketch& sketch,
+      const double quantile
+   ) -> double {
+      if (sketch.count == 0)
+         return 0.0;
+      const double rank = std::clamp(quantile, 0.0, 1.0) * static_cast<double>(sketch.count - 1);
+      if (rank >= static_cast<double>(sketch.count - 1))
+         return static_cast<double>(sketch.max_value);
+      double value = 0.0;
+      std::int64_t cumulative = sketch.zero_count;
+      if (static_cast<double>(cumulative) <= rank) {
+         for (size_t i = 0; i < sketch.counts.size(); ++i) {
+            cumulative += sketch.counts[i];
+            if (static_cast<double>(cumulative) > rank) {
+               // bucket i covers (gamma^(index-1), gamma^index]
+               const double gamma = std::exp(sketch.log_gamma);
+               value = 2.0 * std::exp(sketch.log_gamma * (sketch.min_index + static_cast<int>(i))) / (gamma + 1.0);
+               break;
+            }
+         }
+      }
+      return std::clamp(value, static_cast<double>(sketch.min_value), static_cast<double>(sketch.max_value));
+   }
+
+
+   [[nodiscard]] inline auto get_ms_from_sketch(
+      const QuantileSketch& sketch,
+      const double quantile,
+      const double ms_per_tick
+   ) -> float_type {
+      return static_cast<float_type>(get_sketch_quantile(sketch, quantile) * ms_per_tick);
+   }
+
+
+   // Without the samples, the CIs aren't available and the p-values are
+   // always Welch's from the running statistics
+   [[nodiscard]] inline auto get_sketched_zone_result(
+      const Zone& zone,
+      const Zone& baseline,
+      const bool is_null_zone,
+      const double ms_per_tick,
+      const Config& pconfig
+   ) -> ZoneResult {
+      ZoneResult zr;
+      zr.median = get_ms_from_sketch(zone.frame_sketch, 0.5, ms_per_tick);
+      zr.zonetime_median = get_ms_from_sketch(zone.zone_sketch, 0.5, ms_per_tick);
+      zr.mean = static_cast<float_type>(zone.frame_tick_mean * ms_per_tick);
+      zr.std_dev = static_cast<float_type>(std::sqrt(get_frame_tick_variance(zone)) * ms_per_tick);
+      zr.worst_time = get_ms_from_ticks(zone.frame_sketch.max_value, ms_per_tick);
+      for (const float_type percentile : pconfig.percentiles)
+         zr.percentiles.emplace_back(get_ms_from_sketch(zone.frame_sketch, percentile / 100.0, ms_per_tick));
+      if (!is_null_zone) {
+         zr.p_value = static_cast<float_type>(get_welch_p_value(
+            zone.frame_tick_mean, get_frame_tick_variance(zone), static_cast<double>(zone.frame_count),
+            baseline.frame_tick_mean, get_frame_tick_variance(baseline), static_cast<double>(baseline.frame_count)
+         ));
+      }
+      return zr;
+   }
+
+
+   // Puts the elements of the sorted ranks [begin, end) into their sorted
+   // positions, everything before them is smaller and everything after them
+   // larger. Ranges must be ascending and not overlap. Linear time for a few
+   // short ranges, instead of a full sort.
+   inline auto select_ranks(
+      std::vector<float_type>& vec,
+      const std::vector<std::pair<size_t, size_t>>& ranges
+   ) -> void {
+      auto first = std::begin(vec);
+      for (const auto& [begin, end] : ranges) {
+         if (begin >= vec.size() || std::begin(vec) + begin < first)
+            continue;
+         const auto range_begin = std::begin(vec) + begin;
+         const auto range_end = std::begin(vec) + std::min(end, vec.size());
+         std::nth_element(first, range_begin, std::end(vec));
+         if (range_end - range_begin > 1)
+            std::partial_sort(range_begin + 1, range_end, std::end(vec));
+         first = range_end;
+      }
+   }
+
+
+   // What get_median(), get_percentile(), the worst time and the bootstrap
+   // read. The bootstrap medians are within a few sqrt(n) ranks of the median,
+   // the window is large enough to never miss in practice.
+   inline auto select_evaluated_ranks(
+      std::vector<float_type>& vec,
+      const std::vector<float_type>& percentiles,
+      const bool with_bootstrap
+   ) -> void {
+      const size_t n = vec.size();
+      if (n == 0)
+         return;
+      std::vector<std::pair<size_t, size_t>> ranges;
+      const size_t half_window = with_bootstrap ? static_cast<size_t>(8.0 * std::sqrt(static_cast<double>(n))) + 2 : 1;
+      ranges.emplace_back(n / 2 - std::min(n / 2, half_window), n / 2 + half_window);
+      for (const float_type percentile : percentiles) {
+         const size_t lower = static_cast<size_t>(std::clamp(percentile, static_cast<float_type>(0.0), static_cast<float_type>(100.0)) / static_cast<float_type>(100.0) * (n - 1));
+         ranges.emplace_back(lower, lower + 2);
+      }
+      ranges.emplace_back(n - 1, n);
+
+      // sorted and merged, so that they don't overlap
+      std::sort(std::begin(ranges), std::end(ranges));
+      std::vector<std::pair<size_t, size_t>> merged;
+      for (const auto& range : ranges) {
+         if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, range.second);
+         else
+            merged.emplace_back(range);
+      }
+      select_ranks(vec, merged);
+   }
+
+
+   // get_percentile() without sorting, reorders vec
+   [[nodiscard]] inline auto get_selected_percentile(
+      std::vector<float_type>& vec,
+      const float_type percentile
+   ) -> float_type {
+      if (vec.empty())
+         return static_cast<float_type>(0.0);
+      const float_type rank = std::clamp(percentile, static_cast<float_type>(0.0), static_cast<float_type>(100.0)) / static_cast<float_type>(100.0) * (vec.size() - 1);
+      const size_t lower = static_cast<size_t>(rank);
+      select_ranks(vec, { { lower, lower + 2 } });
+      return get_percentile(vec, percentile);
+   }
+
+
+   // Removes the outliers from vec (in any order) and returns how many. MAD
+   // and IQR reject by value, so nothing is rejected if most samples are
+   // equal. The trimmed mean drops the same number of samples on both ends.
+   inline auto reject_outliers(
+      std::vector<float_type>& vec,
+      const OutlierPolicy policy,
+      const float_type threshold
+   ) -> size_t {
+      const size_t n = vec.size();
+      if (policy == OutlierPolicy::None || n < 3)
+         return 0;
+      if (policy == OutlierPolicy::TrimmedMean) {
+         const float_type fraction = std::clamp(threshold, static_cast<float_type>(0.0), static_cast<float_type>(0.5));
+         const size_t k = std::min(static_cast<size_t>(fraction * n), (n - 1) / 2);
+         if (k == 0)
+            return 0;
+         select_ranks(vec, { { k, k + 1 }, { n - k - 1, n - k } });
+         vec.erase(std::end(vec) - k, std::end(vec));
+         vec.erase(std::begin(vec), std::begin(vec) + k);
+         return 2 * k;
+      }
+
+      std::vector<float_type> scratch = vec;
+      float_type low = 0.0, high = 0.0;
+      if (policy == OutlierPolicy::Mad) {
+         const float_type median = get_selected_percentile(scratch, 50.0);
+         for (float_type& value : scratch)
+            value = std::abs(value - median);
+         // scaled so that it estimates the std dev of normal distributions
+         const float_type mad = get_selected_percentile(scratch, 50.0) / static_cast<float_type>(0.6745);
+         low = median - threshold * mad;
+         high = median + threshold * mad;
+      }
+      else {
+         const float_type q1 = get_selected_percentile(scratch, 25.0);
+         const float_type q3 = get_selected_percentile(scratch, 75.0);
+         low = q1 - threshold * (q3 - q1);
+         high = q3 + threshold * (q3 - q1);
+      }
+      if (low == high)
+         return 0;
+      vec.erase(std::remove_if(std::begin(vec), std::end(vec), [&](const float_type value) { return value < low || value > high; }), std::end(vec));
+      return n - vec.size();
+   }
+
+
+   // The baseline result is nullptr for the baseline itself
+   [[nodiscard]] inline auto get_zone_result(
+      const Zone& zone,
+      const Zone& baseline_zone,
+      const ZoneResult* baseline_result,
+      const double ms_per_tick,
+      const Config& pconfig,
+      std::uint64_t& rng_state
+   ) -> ZoneResult {
+      ZoneResult zr;
+      if (zone.frame_sketch.count > 0 || zone.zone_sketch.count > 0) {
+         zr = get_sketched_zone_result(zone, baseline_zone, baseline_result == nullptr, ms_per_tick, pconfig);
+      }
+      else {
+         // Only the ranks the evaluation reads are selected, the result
+         // vectors sort themselves when they're first read
+         std::vector<float_type>& frame_times = zr.sorted_frame_times.m_times;
+         frame_times = get_ms_from_ticks(zone.frame_times, ms_per_tick);
+         const float_type threshold = pconfig.outlier_policy == OutlierPolicy::TrimmedMean ? pconfig.trim_fraction : pconfig.outlier_threshold;
+         zr.rejected_count = reject_outliers(frame_times, pconfig.outlier_policy, threshold);
+         select_evaluated_ranks(frame_times, pconfig.percentiles, pconfig.bootstrap_resamples > 0);
+         std::vector<float_type>& zone_times = zr.sorted_zone_times.m_times;
+         zone_times = get_ms_from_ticks(zone.zone_times, ms_per_tick);
+         select_evaluated_ranks(zone_times, {}, false);
+
+         zr.median = get_median(frame_times);
+         zr.zonetime_median = get_median(zone_times);
+         const Moments moments = get_moments(frame_times);
+         zr.mean = static_cast<float_type>(moments.mean);
+         zr.std_dev = static_cast<float_type>(std::sqrt(moments.m2 / (moments.count - 1.0)));
+         zr.worst_time = frame_times.empty() ? static_cast<float_type>(0.0) : frame_times.back();
+         for (const float_type percentile : pconfig.percentiles)
+            zr.percentiles.emplace_back(get_percentile(frame_times, percentile));
+         if (baseline_result != nullptr) {
+            const std::vector<float_type>& baseline = baseline_result->sorted_frame_times.m_times;
+            get_bootstrap_median_diff_ci(frame_times, baseline, pconfig.bootstrap_resamples, rng_state, zr.ci_low, zr.ci_high);
+            if (pconfig.significance_test == SignificanceTest::MannWhitney) {
+               // The ranks need everything sorted. The baseline is sorted
+               // once for all zones, this zone only as a scratch copy.
+               std::vector<float_type> ranked = frame_times;
+               std::sort(std::begin(ranked), std::end(ranked));
+               zr.p_value = static_cast<float_type>(get_mann_whitney_p_value(ranked, baseline_result->sorted_frame_times.get()));
+            }
+            else {
+               zr.p_value = static_cast<float_type>(get_welch_p_value(frame_times, baseline));
+            }
+         }
+      }
+      zr.name = zone.name;
+      if (pconfig.keep_raw_ticks) {
+         zr.frame_ticks = zone.frame_times;
+         zr.zone_ticks = zone.zone_times;
+      }
+      for (const std::int64_t thread_sum : zone.thread_zone_sums) {
+         const double mean_ticks = zone.zone_count == 0 ? 0.0 : static_cast<double>(thread_sum) / static_cast<double>(zone.zone_count);
+         zr.thread_zonetime_means.emplace_back(static_cast<float_type>(mean_ticks * ms_per_tick));
+      }
+      return zr;
+   }
+
+
+   [[nodiscard]] inline auto get_zone_results(
+      const std::vector<Zone>& zones,
+      const double ms_per_tick,
+      const Config& pconfig
+   ) -> std::vector<ZoneResult> {
+      std::uint64_t rng_state = 0x5eed; // fixed, so the CIs are reproducible
+      std::vector<ZoneResult> zone_results;
+      for (const Zone& zone : zones) {
+         const ZoneResult* baseline_result = zone_results.empty() ? nullptr : &zone_results.front();
+         zone_results.emplace_back(get_zone_result(zone, zones.front(), baseline_result, ms_per_tick, pconfig, rng_state));
+      }
+
+      // Disabling a zone also disables what's nested in it
+      for (size_t i = 1; i < zone_results.size(); ++i) {
+         zone_results[i].parent = zones[i].parent;
+         zone_results[i].inclusive_delta = zone_results[i].median - zone_results.front().median;
+         zone_results[i].exclusive_delta = zone_results[i].inclusive_delta;
+      }
+      for (size_t i = 1; i < zone_results.size(); ++i) {
+         const size_t parent = zone_results[i].parent;
+         if (parent != 0)
+            zone_results[parent].exclusive_delta -= zone_results[i].inclusive_delta;
+      }
+      return zone_results;
+   }
+
+
+   // Weighted least squares over the means of the points, which is the same as
+   // fitting every sample. Uses the running moments, so it works with sketches.
+   [[nodiscard]] inline auto get_workload_results(
+      const std::vector<Zone>& zones,
+      const std::vector<std::string>& workloads,
+      const std::vector<WorkloadPoint>& workload_points,
+      const std::vector<ZoneResult>& zone_results,
+      const double ms_per_tick,
+      const Config& pconfig
+   ) -> std::vector<WorkloadResult> {
+      std::uint64_t rng_state = 0x10ad; // separate from the zones, like the interactions
+      std::vector<WorkloadResult> workload_results;
+      for (size_t w = 0; w < workloads.size(); ++w) {
+         WorkloadResult wr;
+         wr.name = workloads[w];
+         std::vector<std::pair<double, const Zone*>> points{ { 1.0, &zones.front() } };
+         for (const WorkloadPoint& point : workload_points) {
+            if (point.workload != w)
+               continue;
+            points.emplace_back(static_cast<double>(point.fraction), &point.record);
+            wr.fraction_results.emplace_back(get_zone_result(point.record, zones.front(), &zone_results.front(), ms_per_tick, pconfig, rng_state));
+         }
+         // nothing to fit against the baseline
+         if (wr.fraction_results.empty())
+            continue;
+
+         double n = 0.0, sum_x = 0.0, sum_y = 0.0;
+         for (const auto& [x, zone] : points) {
+            const double count = static_cast<double>(zone->frame_count);
+            n += count;
+            sum_x += count * x;
+            sum_y += count * zone->frame_tick_mean;
+         }
+         const double mean_x = n > 0.0 ? sum_x / n : 0.0;
+         const double mean_y = n > 0.0 ? sum_y / n : 0.0;
+         double sxx = 0.0, sxy = 0.0;
+         for (const auto& [x, zone] : points) {
+            const double count = static_cast<double>(zone->frame_count);
+            sxx += count * (x - mean_x) * (x - mean_x);
+            sxy += count * (x - mean_x) * (zone->frame_tick_mean - mean_y);
+         }
+         const double slope = sxx > 0.0 ? sxy / sxx : 0.0;
+         const double intercept = mean_y - slope * mean_x;
+         double sse = 0.0; // around the fitted line: within each point plus the point means
+         for (const auto& [x, zone] : points) {
+            const double residual = zone->frame_tick_mean - (intercept + slope * x);
+            sse += zone->frame_tick_m2 + static_cast<double>(zone->frame_count) * residual * residual;
+         }
+         const double slope_se = (sxx > 0.0 && n > 2.0) ? std::sqrt(sse / (n - 2.0) / sxx) : 0.0;
+         wr.cost = static_cast<float_type>(slope * ms_per_tick);
+         wr.cost_ci = static_cast<float_type>(get_t_quantile_95(n - 2.0) * slope_se * ms_per_tick);
+         wr.fixed_time = static_cast<float_type>(intercept * ms_per_tick);
+         workload_results.emplace_back(std::move(wr));
+      }
+      return workload_results;
+   }
+
+
+   // Main effects are the zone results, this adds the pairs on top
+   [[nodiscard]] inline auto get_interaction_results(
+      const std::vector<Zone>& zones,
+      const std::vector<Combination>& combinations,
+      const std::vector<ZoneResult>& zone_results,
+      const double ms_per_tick,
+      const Config& pconfig
+   ) -> std::vector<InteractionResult> {
+      std::uint64_t rng_state = 0xc0b0; // separate from the zones, so adding pairs doesn't change their CIs
+      std::vector<InteractionResult> interaction_results;
+      for (const Combination& combination : combinations) {
+         InteractionResult ir;
+         ir.zone_a = 0;
+         ir.zone_b = 0;
+         for (size_t i = 1; i < 64; ++i) {
+            if (((combination.disabled_mask >> i) & 1) == 0)
+               continue;
+            if (ir.zone_a == 0)
+               ir.zone_a = i;
+            else
+               ir.zone_b = i;
+         }
+         ir.result = get_zone_result(combination.record, zones.front(), &zone_results.front(), ms_per_tick, pconfig, rng_state);
+         const float_type base = zone_results.front().median;
+         const float_type saved_a = base - zone_results[ir.zone_a].median;
+         const float_type saved_b = base - zone_results[ir.zone_b].median;
+         const float_type saved_both = base - ir.result.median;
+         ir.interaction = saved_both - saved_a - saved_b;
+         interaction_results.emplace_back(ir);
+      }
+      return interaction_results;
+   }
+
+
+   inline auto record_slice(State& state, const std::int64_t frame_ticks) -> void {
+      const bool sketching = state.sketch_log_gamma > 0.0;
+      Zone& target = get_record(state, state.target_config);
+      if (sketching)
+         add_to_sketch(target.frame_sketch, frame_ticks, state.sketch_log_gamma);
+      else
+         target.frame_times.emplace_back(frame_ticks);
+      ++target.frame_count;
+      const double delta = static_cast<double>(frame_ticks) - target.frame_tick_mean;
+      target.frame_tick_mean += delta / static_cast<double>(target.frame_count);
+      target.frame_tick_m2 += delta * (static_cast<double>(frame_ticks) - target.frame_tick_mean);
+      const size_t thread_count = state.thread_buffers.size();
+      for (Zone& zone : state.zones) {
+         if (zone.zone_buffer_count == 0)
+            continue;
+         if (sketching)
+            add_to_sketch(zone.zone_sketch, zone.zone_buffer, state.sketch_log_gamma);
+         else
+            zone.zone_times.emplace_back(zone.zone_buffer);
+         ++zone.zone_count;
+         // threads that showed up late count as zero for the earlier slices
+         zone.thread_zone_sums.resize(thread_count, 0);
+         zone.thread_zone_buffers.resize(thread_count, 0);
+         for (size_t t = 0; t < thread_count; ++t)
+            zone.thread_zone_sums[t] += zone.thread_zone_buffers[t];
+      }
+      ++state.recorded_slices;
+   }
+
+
+   // Whether zone_index is inside ancestor_index, or the same
+   [[nodiscard]] inline auto is_nested_in(
+      const std::vector<Zone>& zones,
+      size_t zone_index,
+      const size_t ancestor_index
+   ) -> bool {
+      while (zone_index != 0 && zone_index < zones.size()) {
+         if (zone_index == ancestor_index)
+            return true;
+         zone_index = zones[zone_index].parent;
+      }
+      return false;
+   }
+
+
+   // Adds what the threads recorded since the last slice to the zone buffers
+   inline auto merge_thread_buffers(State& state) -> void {
+      const size_t thread_count = state.thread_buffers.size();
+      for (size_t t = 0; t < thread_count; ++t) {
+         ThreadBuffer& buffer = *state.thread_buffers[t];
+         const ThreadBuffer::Totals* totals = buffer.totals.load(std::memory_order_acquire);
+         if (totals == nullptr)
+            continue;
+         buffer.merged.resize(totals->size, 0);
+         buffer.merged_counts.resize(totals->size, 0);
+         const size_t n = std::min(totals->size, state.zones.size());
+         for (size_t i = 0; i < n; ++i) {
+            const size_t parent = totals->values[i].parent.load(std::memory_order_relaxed);
+            if (parent != 0 && state.zones[i].parent == 0 && !is_nested_in(state.zones, parent, i))
+               state.zones[i].parent = parent;
+            const std::int64_t count = totals->values[i].count.load(std::memory_order_acquire);
+            const std::int64_t count_delta = count - buffer.merged_counts[i];
+            buffer.merged_counts[i] = count;
+            if (count_delta == 0)
+               continue;
+            const std::int64_t total = totals->values[i].value.load(std::memory_order_relaxed);
+            const std::int64_t delta = total - buffer.merged[i];
+            buffer.merged[i] = total;
+            Zone& zone = state.zones[i];
+            zone.zone_buffer += delta;
+            zone.zone_buffer_count += count_delta;
+            zone.thread_zone_buffers.resize(thread_count, 0);
+            zone.thread_zone_buffers[t] += delta;
+         }
+      }
+   }
+
+
+   inline auto reclaim_versions(State& state) -> void {
+      reclaim_versions(state, state.registry_versions);
+      reclaim_versions(state, state.trace.storages);
+   }
+
+
+   inline auto clear_zone_buffers(State& state) -> void {
+      for (Zone& zone : state.zones) {
+         zone.zone_buffer = 0;
+         zone.zone_buffer_count = 0;
+         std::fill(std::begin(zone.thread_zone_buffers), std::end(zone.thread_zone_buffers), 0);
+      }
+   }
+
+
+   namespace printing {
+
+      [[nodiscard]] auto inline get_max_zone_name_len(
+         const std::vector<ZoneResult>& zone_results,
+         const int min_len
+      ) -> int {
+         int max_name_len = min_len;
+         for (const ZoneResult& result : zone_results) {
+            const int len = static_cast<int>(result.name.length());
+            if (len > max_name_len)
+               max_name_len = len;
+         }
+         return max_name_len;
+      }
+
+
+      enum class EvalType { Median, MedianCi, PValue, Mean, Percentile, Worst, StdDev, ZonetimeMedian, Rejected, InclusiveDelta, ExclusiveDelta };
+
+
+      [[nodiscard]] inline auto get_result_eval(
+         const ZoneResult& result,
+         const EvalType eval_type,
+         const size_t percentile_index,
+         const ReportTimeMode time_mode
+      ) -> float_type {
+         // std dev is relative and zone times are no frame times, no FPS for them
+         if (eval_type == EvalType::StdDev)
+            return result.std_dev;
+         if (eval_type == EvalType::ZonetimeMedian)
+            return result.zonetime_median;
+         float_type ms_value = static_cast<float_type>(0.0);
+         if (eval_type == EvalType::Median)
+            ms_value = result.median;
+         else if (eval_type == EvalType::Mean)
+            ms_value = result.mean;
+         else if (eval_type == EvalType::Worst)
+            ms_value = result.worst_time;
+         else if (eval_type == EvalType::Percentile && percentile_index < result.percentiles.size())
+            ms_value = result.percentiles[percentile_index];
+
+         if (time_mode == ReportTimeMode::Ms)
+            return ms_value;
+         else
+            return static_cast<float_type>(1000.0) / ms_value;
+      }
+
+
+      template<class T>
+      [[nodiscard]] constexpr auto auto_get_digits_before_point(const T num) -> int {
+         if (std::abs(num) < static_cast<float_type>(1.0))
+            return 0;
+         return std::max(static_cast<int>(std::log10(std::abs(num))) + 1, 0);
+      }
+
+
+      [[nodiscard]] inline auto get_fractional_string(
+         const float_type num,
+         const int digits
+      ) -> std::string {
+         float_type integral;
+         const float_type fractional = std::modf(num, &integral);
+         const float_type x = fractional * static_cast<float_type>(std::pow(static_cast<float_type>(10.0), digits));
+         const int i = static_cast<int>(std::round(x));
+         std::string s = std::to_string(i);
+         if (static_cast<int>(s.length()) < digits && i != 0)
+            s.insert(0, digits - s.length(), '0'); // 0.05 -> "05"
+         s.resize(digits, '0');
+         return s;
+      }
+
+
+      [[nodiscard]] inline auto get_num_str(
+         const float_type num,
+         const int significant_digits,
+         const bool with_sign
+      ) -> std::string {
+         std::string s;
+         if (with_sign)
+            s += num < static_cast<float_type>(0.0) ? "-" : "+";
+         const float_type abs_num = std::abs(num);
+
+         {
+            const int whole_rounded = static_cast<int>(std::round(abs_num));
+            const int rounded_predot_digits = auto_get_digits_before_point(whole_rounded);
+            if (rounded_predot_digits >= significant_digits) {
+               s += std::to_string(whole_rounded);
+               return s;
+            }
+         }
 
          const int predot_digits = auto_get_digits_before_point(abs_num);
-         s += std::to_string(static_cast<int>(abs_num));
+         int digits_left = significant_digits - predot_digits;
+
+         // rounded first, so that 4.9999 carries over into "5.00"
+         const float_type scale = static_cast<float_type>(std::pow(static_cast<float_type>(10.0), std::max(digits_left, 0)));
+         const float_type rounded = std::round(abs_num * scale) / scale;
+         digits_left -= auto_get_digits_before_point(rounded) - predot_digits; // 0.9999 -> "1.00"
+         s += std::to_string(static_cast<int>(rounded));
+         if (digits_left > 0) {
+            s += ".";
+            s += get_fractional_string(rounded, digits_left);
+         }
+
+         return s;
+      }
+
+
+      [[nodiscard]] constexpr auto get_percentage(
+         const float_type numerator,
+         const float_type denominator
+      ) -> float_type {
+         return static_cast<float_type>(100.0)* numerator / denominator;
+      }
+
+
+      // The CI is of the median difference in ms. In FPS mode, the percentage of
+      // the FPS change flips the order of the bounds.
+      [[nodiscard]] inline auto get_ci_str(
+         const ZoneResult& result,
+         const ZoneResult& baseline_result,
+         const ReportTimeMode time_mode
+      ) -> std::string {
+         if (result.ci_low == result.ci_high || baseline_result.median <= static_cast<float_type>(0.0))
+            return "";
+         const auto get_relative = [&](const float_type ms_diff) {
+            if (time_mode == ReportTimeMode::Ms)
+               return get_percentage(ms_diff, baseline_result.median);
+            return get_percentage(baseline_result.median, baseline_result.median + ms_diff) - static_cast<float_type>(100.0);
+         };
+         float_type low = get_relative(result.ci_low);
+         float_type high = get_relative(result.ci_high);
+         if (low > high)
+            std::swap(low, high);
+         return get_num_str(low, 2, true) + ".." + get_num_str(high, 2, true);
+      }
+
+
+      // "n.s." flags zones whose removal makes no significant difference
+      [[nodiscard]] inline auto get_p_value_str(
+         const ZoneResult& result,
+         const float_type significance_level
+      ) -> std::string {
+         if (result.p_value < static_cast<float_type>(0.001))
+            return "<0.001";
+         std::string str = get_num_str(result.p_value, 2, false);
+         if (result.p_value >= significance_level)
+            str += " n.s.";
+         return str;
+      }
+
+
+      [[nodiscard]] inline auto get_cell_str(
+         const ZoneResult& result, 
+         const ZoneResult& baseline_result,
+         const bool is_null_zone,
+         const EvalType& eval_type,
+         const size_t percentile_index,
+         const Config& pconfig
+      ) -> std::string {
+         const ReportTimeMode time_mode = pconfig.report_time_mode;
+         if (eval_type == EvalType::MedianCi)
+            return is_null_zone ? "" : get_ci_str(result, baseline_result, time_mode);
+         if (eval_type == EvalType::PValue)
+            return is_null_zone ? "" : get_p_value_str(result, pconfig.significance_level);
+         if (eval_type == EvalType::Rejected)
+            return std::to_string(result.rejected_count);
+         if (eval_type == EvalType::InclusiveDelta)
+            return is_null_zone ? "" : get_num_str(result.inclusive_delta, 3, true);
+         if (eval_type == EvalType::ExclusiveDelta)
+            return is_null_zone ? "" : get_num_str(result.exclusive_delta, 3, true);
+         // a missing percentile is an empty cell, not a 0 that turns into inf fps
+         const auto has_percentile = [&](const ZoneResult& r) { return percentile_index < r.percentiles.size(); };
+         if (eval_type == EvalType::Percentile && (!has_percentile(result) || (!is_null_zone && !has_percentile(baseline_result))))
+            return "";
+         const float_type value = get_result_eval(result, eval_type, percentile_index, time_mode);
+         if (eval_type == EvalType::StdDev)
+            return get_num_str(get_percentage(value, result.mean), 3, false);
+         else if (eval_type == EvalType::ZonetimeMedian) {
+            if(value>0)
+               return get_num_str(value, 3, false);
+            return "";
+         }
+         std::string cell_str = get_num_str(value, 3, false);
+         if (is_null_zone)
+            return cell_str;
+
+         const float_type baseline = get_result_eval(baseline_result, eval_type, percentile_index, time_mode);
+         const float_type diff = value - baseline;
+         const float_type improv_percent = get_percentage(diff, baseline);
+         cell_str += " (" + get_num_str(improv_percent, 2, true) + "%)";
+         return cell_str;
+      }
+
+
+      struct TableColumn {
+         std::string header;
+         std::vector<std::string> cells; // one per zone result
+         int max_width = 3;
+      };
+
+      using ResultTable = std::vector<TableColumn>;
+
+
+      [[nodiscard]] inline auto get_table_column(
+         const std::vector<ZoneResult>& zone_results,
+         const std::string& header,
+         const EvalType eval_type,
+         const size_t percentile_index,
+         const Config& pconfig
+      ) -> TableColumn {
+         TableColumn column;
+         column.header = header;
+         column.max_width = std::max(column.max_width, static_cast<int>(header.length()));
+         column.cells.reserve(zone_results.size());
+         for (size_t i = 0; i < zone_results.size(); ++i) {
+            const std::string cell_str = get_cell_str(zone_results[i], zone_results[0], i==0, eval_type, percentile_index, pconfig);
+            column.max_width = std::max(column.max_width, static_cast<int>(cell_str.length()));
+            column.cells.emplace_back(std::move(cell_str));
+         }
+         return column;
+      }
+
+
+      inline auto get_united_str(
+         const std::string& description,
+         const Config& pconfig
+      ) -> std::string {
+         std::string s = description;
+         if (pconfig.report_time_mode == ReportTimeMode::Fps)
+            s += "[FPS]";
+         else
+            s += "[ms]";
+         return s;
+      }
+
+
+      // "p99", "p99.9"
+      [[nodiscard]] inline auto get_percentile_str(const float_type percentile) -> std::string {
+         char buffer[32];
+         snprintf(buffer, sizeof(buffer), "p%g", static_cast<double>(percentile));
+         return buffer;
+      }
+
+
+      // "x0.25"
+      [[nodiscard]] inline auto get_fraction_str(const float_type fraction) -> std::string {
+         char buffer[32];
+         snprintf(buffer, sizeof(buffer), "x%g", static_cast<double>(fraction));
+         return buffer;
+      }
+
+
+      [[nodiscard]] inline auto get_result_table(
+         const std::vector<ZoneResult>& zone_results,
+         const Config& pconfig
+      ) -> ResultTable {
+         const char* p_header = pconfig.significance_test == SignificanceTest::Welch ? "p(Welch)" : "p(MWU)";
+         ResultTable table;
+         table.emplace_back(get_table_column(zone_results, get_united_str("median", pconfig), EvalType::Median, 0, pconfig));
+         table.emplace_back(get_table_column(zone_results, "ci95[%]", EvalType::MedianCi, 0, pconfig));
+         table.emplace_back(get_table_column(zone_results, p_header, EvalType::PValue, 0, pconfig));
+         table.emplace_back(get_table_column(zone_results, get_united_str("mean", pconfig), EvalType::Mean, 0, pconfig));
+         for (size_t i = 0; i < pconfig.percentiles.size(); ++i) {
+            const std::string header = get_united_str(get_percentile_str(pconfig.percentiles[i]), pconfig);
+            table.emplace_back(get_table_column(zone_results, header, EvalType::Percentile, i, pconfig));
+         }
+         table.emplace_back(get_table_column(zone_results, get_united_str("worst", pconfig), EvalType::Worst, 0, pconfig));
+         table.emplace_back(get_table_column(zone_results, "std dev[%]", EvalType::StdDev, 0, pconfig));
+         table.emplace_back(get_table_column(zone_results, "ztm", EvalType::ZonetimeMedian, 0, pconfig));
+         if (pconfig.outlier_policy != OutlierPolicy::None)
+            table.emplace_back(get_table_column(zone_results, "rejected", EvalType::Rejected, 0, pconfig));
+         const bool is_nested = std::any_of(std::cbegin(zone_results), std::cend(zone_results), [](const ZoneResult& result) { return result.parent != 0; });
+         if (is_nested) {
+            table.emplace_back(get_table_column(zone_results, "incl[ms]", EvalType::InclusiveDelta, 0, pconfig));
+            table.emplace_back(get_table_column(zone_results, "excl[ms]", EvalType::ExclusiveDelta, 0, pconfig));
+         }
+         return table;
+      }
+
+
+      inline auto append_padded(
+         std::string& str,
+         const std::string& cell,
+         const int width
+      ) -> void {
+         str += cell;
+         if (static_cast<int>(cell.length()) < width)
+            str.append(width - cell.length(), ' ');
+      }
+
+
+      // The name column is left empty in the header (i == -1)
+      inline auto append_table_line(
+         std::string& str,
+         const int name_col_len,
+         const std::string& name_col,
+         const ResultTable& table,
+         const int i
+      ) -> void {
+         append_padded(str, name_col, name_col_len);
+         for (const TableColumn& column : table) {
+            str += ' ';
+            append_padded(str, i < 0 ? column.header : column.cells[i], column.max_width);
+         }
+         str += '\n';
+      }
+
+
+      // Empty unless timezones ran on more than one thread. Threads without
+      // zone time, like the one calling dt::slice(), are left out.
+      [[nodiscard]] inline auto get_thread_breakdown_str(
+         const std::vector<ZoneResult>& zone_results,
+         const int name_col_len
+      ) -> std::string {
+         std::vector<size_t> threads;
+         for (size_t t = 0; ; ++t) {
+            bool exists = false, has_zone_time = false;
+            for (const ZoneResult& result : zone_results) {
+               if (t >= result.thread_zonetime_means.size())
+                  continue;
+               exists = true;
+               has_zone_time = has_zone_time || result.thread_zonetime_means[t] > static_cast<float_type>(0.0);
+            }
+            if (!exists)
+               break;
+            if (has_zone_time)
+               threads.emplace_back(t);
+         }
+         if (threads.size() < 2)
+            return "";
+
+         std::vector<int> col_widths(threads.size(), 3);
+         for (size_t c = 0; c < threads.size(); ++c) {
+            col_widths[c] = std::max(col_widths[c], static_cast<int>(("t" + std::to_string(threads[c])).length()));
+            for (const ZoneResult& result : zone_results) {
+               if (threads[c] < result.thread_zonetime_means.size())
+                  col_widths[c] = std::max(col_widths[c], static_cast<int>(get_num_str(result.thread_zonetime_means[threads[c]], 3, false).length()));
+            }
+         }
+
+         const auto append_cell = [](std::string& str, const std::string& cell, const int width) {
+            str += " " + cell;
+            str.append(std::max(0, width - static_cast<int>(cell.length())), ' ');
+         };
+         std::string str = "\nmean zone time per thread[ms]:\n";
+         str.append(name_col_len, ' ');
+         for (size_t c = 0; c < threads.size(); ++c)
+            append_cell(str, "t" + std::to_string(threads[c]), col_widths[c]);
+         str += "\n";
+         for (const ZoneResult& result : zone_results) {
+            if (result.thread_zonetime_means.empty())
+               continue;
+            std::string name_col = result.name + ":";
+            name_col.resize(std::max(name_col.size(), static_cast<size_t>(name_col_len)), ' ');
+            str += name_col;
+            for (size_t c = 0; c < threads.size(); ++c) {
+               const size_t t = threads[c];
+               const float_type mean = t < result.thread_zonetime_means.size() ? result.thread_zonetime_means[t] : static_cast<float_type>(0.0);
+               append_cell(str, get_num_str(mean, 3, false), col_widths[c]);
+            }
+            str += "\n";
+         }
+         return str;
+      }
+
+
+      // A smaller table below the main one. The first row is the baseline.
+      [[nodiscard]] inline auto get_comparison_str(
+         const std::string& title,
+         const std::vector<ZoneResult>& rows,
+         const char* name_prefix,
+         ResultTable table
+      ) -> std::string {
+         int name_col_len = get_max_zone_name_len(rows, 3);
+         name_col_len += static_cast<int>(strlen(name_prefix));
+         name_col_len += 1; // for colon
+
+         std::string str = "\n" + title + ":\n";
+         append_table_line(str, name_col_len, "", table, -1);
+         for (size_t i = 0; i < rows.size(); ++i) {
+            const std::string name_col = i == 0 ? "all:" : name_prefix + rows[i].name + ":";
+            append_table_line(str, name_col_len, name_col, table, static_cast<int>(i));
+         }
+         return str;
+      }
+
+
+      // Baseline and the pairs, with how much more (positive) or less disabling
+      // both saves than the two on their own
+      [[nodiscard]] inline auto get_interaction_str(
+         const std::vector<ZoneResult>& zone_results,
+         const std::vector<InteractionResult>& interaction_results,
+         const Config& pconfig
+      ) -> std::string {
+         if (interaction_results.empty())
+            return "";
+         std::vector<ZoneResult> rows{ zone_results.front() };
+         for (const InteractionResult& interaction_result : interaction_results)
+            rows.emplace_back(interaction_result.result);
+
+         ResultTable table;
+         table.emplace_back(get_table_column(rows, get_united_str("median", pconfig), EvalType::Median, 0, pconfig));
+         table.emplace_back(get_table_column(rows, "ci95[%]", EvalType::MedianCi, 0, pconfig));
+         TableColumn interaction_column;
+         interaction_column.header = "interaction[ms]";
+         interaction_column.max_width = static_cast<int>(interaction_column.header.length());
+         interaction_column.cells.emplace_back("");
+         for (const InteractionResult& interaction_result : interaction_results) {
+            std::string cell_str = get_num_str(interaction_result.interaction, 3, true);
+            interaction_column.max_width = std::max(interaction_column.max_width, static_cast<int>(cell_str.length()));
+            interaction_column.cells.emplace_back(std::move(cell_str));
+         }
+         table.emplace_back(std::move(interaction_column));
+         std::string str = get_comparison_str("pairwise", rows, "w/o ", std::move(table));
+         const size_t zone_count = zone_results.size() - 1;
+         if (zone_count > get_pairwise_zone_limit(pconfig))
+            str += "only the first " + std::to_string(get_pairwise_zone_limit(pconfig)) + " of " + std::to_string(zone_count) + " zones are paired, see dt::set_max_pairwise_zones()\n";
+         return str;
+      }
+
+
+      // The frame times predicted for each zone being faster
+      [[nodiscard]] inline auto get_speedup_str(
+         const std::vector<ZoneResult>& zone_results,
+         const std::vector<ZoneResult>& speedup_results,
+         const Config& pconfig
+      ) -> std::string {
+         if (speedup_results.empty())
+            return "";
+         std::vector<ZoneResult> rows{ zone_results.front() };
+         rows.insert(std::end(rows), std::begin(speedup_results), std::end(speedup_results));
+
+         const char* p_header = pconfig.significance_test == SignificanceTest::Welch ? "p(Welch)" : "p(MWU)";
+         ResultTable table;
+         table.emplace_back(get_table_column(rows, get_united_str("median", pconfig), EvalType::Median, 0, pconfig));
+         table.emplace_back(get_table_column(rows, "ci95[%]", EvalType::MedianCi, 0, pconfig));
+         table.emplace_back(get_table_column(rows, p_header, EvalType::PValue, 0, pconfig));
+         table.emplace_back(get_table_column(rows, get_united_str("mean", pconfig), EvalType::Mean, 0, pconfig));
+         const std::string title = "virtual speedup by " + get_num_str(pconfig.virtual_speedup * static_cast<float_type>(100.0), 3, false) + "%";
+         return get_comparison_str(title, rows, "faster ", std::move(table));
+      }
+
+
+      // Same columns as the main table, the baseline runs variant 0 everywhere
+      [[nodiscard]] inline auto get_variant_str(
+         const std::vector<ZoneResult>& zone_results,
+         const std::vector<ZoneResult>& variant_results,
+         const Config& pconfig
+      ) -> std::string {
+         if (variant_results.empty())
+            return "";
+         std::vector<ZoneResult> rows{ zone_results.front() };
+         rows.insert(std::end(rows), std::begin(variant_results), std::end(variant_results));
+         return get_comparison_str("variants", rows, "", get_result_table(rows, pconfig));
+      }
+
+
+      // One row per workload: the fitted cost and the median at every fraction
+      [[nodiscard]] inline auto get_workload_str(
+         const std::vector<ZoneResult>& zone_results,
+         const std::vector<WorkloadResult>& workload_results,
+         const Config& pconfig
+      ) -> std::string {
+         if (workload_results.empty())
+            return "";
+         ResultTable table;
+         const auto add_column = [&](const std::string& header, const auto& get_cell) {
+            TableColumn column;
+            column.header = header;
+            column.max_width = std::max(column.max_width, static_cast<int>(header.length()));
+            for (const WorkloadResult& workload_result : workload_results) {
+               std::string cell_str = get_cell(workload_result);
+               column.max_width = std::max(column.max_width, static_cast<int>(cell_str.length()));
+               column.cells.emplace_back(std::move(cell_str));
+            }
+            table.emplace_back(std::move(column));
+         };
+         add_column("cost[ms]", [](const WorkloadResult& wr) { return get_num_str(wr.cost, 3, false); });
+         add_column("ci95[ms]", [](const WorkloadResult& wr) {
+            if (wr.cost_ci <= static_cast<float_type>(0.0))
+               return std::string();
+            return get_num_str(wr.cost - wr.cost_ci, 3, false) + ".." + get_num_str(wr.cost + wr.cost_ci, 3, false);
+         });
+         add_column("fixed[ms]", [](const WorkloadResult& wr) { return get_num_str(wr.fixed_time, 3, false); });
+         const std::vector<float_type> fractions = get_valid_workload_fractions(pconfig.workload_fractions);
+         for (size_t i = 0; i < fractions.size(); ++i) {
+            add_column(get_united_str(get_fraction_str(fractions[i]), pconfig), [&](const WorkloadResult& wr) {
+               if (i >= wr.fraction_results.size())
+                  return std::string();
+               return get_cell_str(wr.fraction_results[i], zone_results.front(), false, EvalType::Median, 0, pconfig);
+            });
+         }
+
+         int name_col_len = 3;
+         for (const WorkloadResult& workload_result : workload_results)
+            name_col_len = std::max(name_col_len, static_cast<int>(workload_result.name.length()) + 1);
+         std::string str = "\nworkloads:\n";
+         append_table_line(str, name_col_len, "", table, -1);
+         for (size_t i = 0; i < workload_results.size(); ++i)
+            append_table_line(str, name_col_len, workload_results[i].name + ":", table, static_cast<int>(i));
+         return str;
+      }
+
+
+      // Zone indices in depth-first order with their nesting depth. Without
+      // nested zones, that's just the zones in order.
+      [[nodiscard]] inline auto get_tree_order(const std::vector<ZoneResult>& zone_results) -> std::vector<std::pair<size_t, int>> {
+         std::vector<std::pair<size_t, int>> order;
+         const auto visit = [&](const auto& self, const size_t parent, const int depth) -> void {
+            for (size_t i = 1; i < zone_results.size(); ++i) {
+               if (zone_results[i].parent != parent)
+                  continue;
+               order.emplace_back(i, depth);
+               self(self, i, depth + 1);
+            }
+         };
+         visit(visit, 0, 0);
+         return order;
+      }
+
+
+      inline auto get_result_str(
+         const Results& presults,
+         const Config& pconfig
+      ) -> std::string {
+         const std::vector<ZoneResult>& zone_results = presults.zone_results;
+         const char* wo_prefix = "w/o ";
+         constexpr int indent_width = 2; // per nesting level
+         const std::vector<std::pair<size_t, int>> tree_order = get_tree_order(zone_results);
+         int name_col_len = get_max_zone_name_len(zone_results, 3);
+         for (const auto& [i, depth] : tree_order)
+            name_col_len = std::max(name_col_len, depth * indent_width + static_cast<int>(zone_results[i].name.length()));
+         name_col_len += static_cast<int>(strlen(wo_prefix));
+         name_col_len += 1; // for colon
+         constexpr int decimal_places = 1;
+         const ResultTable table = get_result_table(zone_results, pconfig);
+
+         std::string output_str;
+         append_table_line(output_str, name_col_len, "", table, -1);
+         if (!zone_results.empty())
+            append_table_line(output_str, name_col_len, "all:", table, 0);
+         for (const auto& [i, depth] : tree_order) {
+            const std::string name_col = std::string(depth * indent_width, ' ') + wo_prefix + zone_results[i].name + ":";
+            append_table_line(output_str, name_col_len, name_col, table, static_cast<int>(i));
+         }
+         output_str += get_interaction_str(zone_results, presults.interaction_results, pconfig);
+         output_str += get_speedup_str(zone_results, presults.speedup_results, pconfig);
+         output_str += get_variant_str(zone_results, presults.variant_results, pconfig);
+         output_str += get_workload_str(zone_results, presults.workload_results, pconfig);
+         const bool has_timezones = std::any_of(std::cbegin(zone_results), std::cend(zone_results), [](const ZoneResult& result) { return !result.thread_zonetime_means.empty(); });
+         if (has_timezones && presults.timezone_overhead_ms > static_cast<float_type>(0.0))
+            output_str += "timezone overhead: " + get_num_str(presults.timezone_overhead_ms * static_cast<float_type>(1'000'000.0), 3, false) + "ns (subtracted from ztm)\n";
+         output_str += get_thread_breakdown_str(zone_results, name_col_len);
+         output_str.push_back('\0');
+         return output_str;
+      }
+
+   } // namespace printing
+
+
+   inline auto evaluate(
+      Results& presults,
+      const Config& pconfig,
+      const std::vector<Zone>& zones,
+      const std::vector<Combination>& combinations,
+      const std::vector<Speedup>& speedups,
+      const std::vector<Alternative>& alternatives,
+      const std::vector<std::string>& workloads,
+      const std::vector<WorkloadPoint>& workload_points,
+      const double ms_per_tick,
+      const std::int64_t timezone_overhead,
+      const size_t thread_count
+   ) -> void {
+      Results evaluated;
+      evaluated.zone_results = get_zone_results(zones, ms_per_tick, pconfig);
+      evaluated.interaction_results = get_interaction_results(zones, combinations, evaluated.zone_results, ms_per_tick, pconfig);
+      std::uint64_t rng_state = 0x5bed; // separate from the zones, like the interactions
+      for (const Speedup& speedup : speedups)
+         evaluated.speedup_results.emplace_back(get_zone_result(speedup.record, zones.front(), &evaluated.zone_results.front(), ms_per_tick, pconfig, rng_state));
+      for (const Alternative& alternative : alternatives)
+         evaluated.variant_results.emplace_back(get_zone_result(alternative.record, zones.front(), &evaluated.zone_results.front(), ms_per_tick, pconfig, rng_state));
+      evaluated.workload_results = get_workload_results(zones, workloads, workload_points, evaluated.zone_results, ms_per_tick, pconfig);
+      evaluated.timezone_overhead_ms = get_ms_from_ticks(timezone_overhead, ms_per_tick);
+      evaluated.config = pconfig;
+      evaluated.ms_per_tick = ms_per_tick;
+      evaluated.thread_count = thread_count;
+      evaluated.result_str = printing::get_result_str(evaluated, pconfig);
+      presults = std::move(evaluated);
+      if (pconfig.report_out_mode == ReportOutMode::ConsoleOut)
+         printf("%s", presults.result_str.c_str());
+   }
+
+
+#ifdef DT_THREADSAFE
+   // Moves the recorded data out, the zones themselves stay registered
+   [[nodiscard]] inline auto take_recorded_zones(State& state) -> std::vector<Zone> {
+      std::vector<Zone> recorded = std::move(state.zones);
+      state.zones.clear();
+      state.zones.resize(recorded.size());
+      for (size_t i = 0; i < recorded.size(); ++i) {
+         state.zones[i].name = recorded[i].name;
+         state.zones[i].parent = recorded[i].parent;
+      }
+      return recorded;
+   }
+
+
+   // The results are only written once they're complete and published with
+   // the Ready status. Printing and the callback happen on the worker thread,
+   // which doesn't hold the lock.
+   inline auto start_async_evaluation(
+      State& state,
+      const Config& pconfig,
+      Results& presults
+   ) -> void {
+      state.status = Status::Evaluating;
+      state.evaluation_thread.join(); // the last one is done, except for returning
+      state.evaluation_thread.thread = std::thread(
+         [&state, &presults, config_copy = pconfig, zones = take_recorded_zones(state), combinations = std::move(state.combinations), speedups = std::move(state.speedups), alternatives = std::move(state.alternatives), workloads = state.workloads, workload_points = std::move(state.workload_points), ms_per_tick = state.ms_per_tick.load(), overhead = state.timezone_overhead.load(), thread_count = state.thread_buffers.size()]() {
+            evaluate(presults, config_copy, zones, combinations, speedups, alternatives, workloads, workload_points, ms_per_tick, overhead, thread_count);
+            // Ready first like in process_slice(), so that the callback can start() again
+            state.status = Status::Ready;
+            if (config_copy.done_cb != nullptr)
+               config_copy.done_cb(presults.zone_results);
+         }
+      );
+   }
+#endif // DT_THREADSAFE
+
+
+   // Mutex locked. Returns true when the results were just evaluated here,
+   // i.e. not asynchronously.
+   [[nodiscard]] inline auto advance_measurement(
+      State& state,
+      const Config& pconfig,
+      Results& presults,
+      const std::int64_t frame_ticks
+   ) -> bool {
+      if (state.status == Status::Ready) {
+         return false;
+      }
+      else if (state.status == Status::Starting) {
+         ensure_null_zone(state, pconfig); // the baseline records into it, even before any zone is registered
+         reset_state(state);
+         if (pconfig.interaction_mode == InteractionMode::Pairwise)
+            add_pairwise_combinations(state, pconfig);
+         add_alternatives(state);
+         add_workload_points(state, pconfig);
+         resize_trace(state, pconfig.trace_capacity);
+         // while nothing is targeted yet, and before the trace starts over
+         state.timezone_overhead = 0;
+         state.timezone_overhead = pconfig.subtract_timezone_overhead ? measure_timezone_overhead() : 0;
+         state.trace.next = 0;
+         state.speedup_fraction = static_cast<double>(get_virtual_speedup(pconfig));
+         state.counted_speedup_delay = state.speedup_delay;
+         const double accuracy = static_cast<double>(pconfig.sketch_accuracy);
+         state.sketch_log_gamma = pconfig.sample_storage == SampleStorage::Sketch ? std::log((1.0 + accuracy) / (1.0 - accuracy)) : 0.0;
+         start_first_block(state, pconfig);
+         state.status = Status::Measuring;
+      }
+      else if (state.status == Status::Measuring) {
+         merge_thread_buffers(state);
+         if (get_virtual_speedup(pconfig) > static_cast<float_type>(0.0))
+            add_speedups(state);
+         const std::int64_t speedup_delay = state.speedup_delay.load();
+         const std::int64_t frame_delay = speedup_delay - state.counted_speedup_delay;
+         state.counted_speedup_delay = speedup_delay;
+         if (state.warmup_runs_left > 0) {
+            --state.warmup_runs_left;
+            clear_zone_buffers(state);
+            return false;
+         }
+         record_slice(state, frame_ticks - frame_delay);
+         clear_zone_buffers(state);
+         if (is_block_done(state, pconfig) && !start_next_block(state, pconfig)) {
+            set_target_config(state, 0);
+#ifdef DT_THREADSAFE
+            if (pconfig.async_evaluation) {
+               start_async_evaluation(state, pconfig, presults);
+               return false;
+            }
+#endif // DT_THREADSAFE
+            evaluate(presults, pconfig, state.zones, state.combinations, state.speedups, state.alternatives, state.workloads, state.workload_points, state.ms_per_tick, state.timezone_overhead, state.thread_buffers.size());
+            state.status = Status::Ready;
+            return true;
+         }
+      }
+      return false;
+   }
+
+
+   inline auto process_slice(
+      State& state,
+      const Config& pconfig,
+      Results& presults,
+      const std::int64_t frame_ticks
+   ) -> void {
+      // measure_timezone_overhead() needs the buffer of this thread, which
+      // can't be registered with the lock held
+      if (state.status == Status::Starting)
+         (void)get_thread_buffer(state);
+      bool evaluated = false;
+      {
+         const ScopedLock lock(state.mutex);
+         reclaim_versions(state);
+         evaluated = advance_measurement(state, pconfig, presults, frame_ticks);
+      }
+      // without the lock, the callback may register zones or reset everything
+      if (evaluated && pconfig.done_cb != nullptr)
+         pconfig.done_cb(presults.zone_results);
+   }
 
-         const int digits_left = significant_digits - predot_digits;
-         if (digits_left > 0) {
-            s += ".";
-            s += get_fractional_string(abs_num, digits_left);
-         }
 
-         return s;
+   // Escapes quotes, backslashes and control characters
+   inline auto write_json_string(
+      FILE* file,
+      const std::string& str
+   ) -> void {
+      fputc('"', file);
+      for (const char c : str) {
+         if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+         else if (static_cast<unsigned char>(c) < 0x20)
+            fprintf(file, "\\u%04x", static_cast<unsigned int>(c));
+         else
+            fputc(c, file);
       }
+      fputc('"', file);
+   }
 
 
-      [[nodiscard]] constexpr auto get_percentage(
-         const float_type numerator,
-         const float_type denominator
-      ) -> float_type {
-         return static_cast<float_type>(100.0)* numerator / denominator;
+   // Chrome trace event format, which ui.perfetto.dev and chrome://tracing
+   // load. Times are in microseconds since the first event.
+   inline auto write_trace_events(
+      FILE* file,
+      const std::vector<TraceEvent>& events,
+      const std::vector<std::string>& zone_names,
+      const size_t thread_count,
+      const double ms_per_tick
+   ) -> void {
+      std::int64_t t_begin = std::numeric_limits<std::int64_t>::max();
+      for (const TraceEvent& event : events)
+         t_begin = std::min(t_begin, event.t0);
+      const double us_per_tick = ms_per_tick * 1000.0;
+
+      fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+      for (size_t t = 0; t < thread_count; ++t)
+         fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"t%zu\"}},\n", t, t);
+      for (const TraceEvent& event : events) {
+         fprintf(file, "{\"name\":");
+         if (event.zone_index == 0 || event.zone_index >= zone_names.size())
+            write_json_string(file, "frame");
+         else
+            write_json_string(file, zone_names[event.zone_index]);
+         fprintf(
+            file, ",\"cat\":\"dt\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f},\n",
+            static_cast<unsigned int>(event.thread_index),
+            static_cast<double>(event.t0 - t_begin) * us_per_tick,
+            static_cast<double>(event.t1 - event.t0) * us_per_tick
+         );
       }
+      // the format allows no trailing comma
+      fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"dt\"}}\n]}\n");
+   }
 
+   [[nodiscard]] constexpr auto get_enum_str(const ReportTimeMode mode) -> const char* {
+      return mode == ReportTimeMode::Ms ? "ms" : "fps";
+   }
+   [[nodiscard]] constexpr auto get_enum_str(const SampleStorage storage) -> const char* {
+      return storage == SampleStorage::Full ? "full" : "sketch";
+   }
+   [[nodiscard]] constexpr auto get_enum_str(const InteractionMode mode) -> const char* {
+      return mode == InteractionMode::None ? "none" : "pairwise";
+   }
+   [[nodiscard]] constexpr auto get_enum_str(const OutlierPolicy policy) -> const char* {
+      switch (policy) {
+      case OutlierPolicy::Mad: return "mad";
+      case OutlierPolicy::Iqr: return "iqr";
+      case OutlierPolicy::TrimmedMean: return "trimmed_mean";
+      default: return "none";
+      }
+   }
+   [[nodiscard]] constexpr auto get_enum_str(const SignificanceTest test) -> const char* {
+      return test == SignificanceTest::MannWhitney ? "mann_whitney" : "welch";
+   }
+   [[nodiscard]] constexpr auto get_enum_str(const ScheduleMode mode) -> const char* {
+      return mode == ScheduleMode::Blocks ? "blocks" : "interleaved";
+   }
 
-      [[nodiscard]] inline auto get_cell_str(
-         const ZoneResult& result, 
-         const ZoneResult& baseline_result,
-         const bool is_null_zone,
-         const EvalType& eval_type,
-         const ReportTimeMode time_mode
-      ) -> std::string {
-         const float_type value = get_result_eval(result, eval_type, time_mode);
-         if (eval_type == EvalType::StdDev)
-            return get_num_str(get_percentage(value, result.mean), 3, false);
-         else if (eval_type == EvalType::ZonetimeMedian) {
-            if(value>0)
-               return get_num_str(value, 3, false);
-            return "";
-         }
-         std::string cell_str = get_num_str(value, 3, false);
-         if (is_null_zone)
-            return cell_str;
 
-         const float_type baseline = get_result_eval(baseline_result, eval_type, time_mode);
-         const float_type diff = value - baseline;
-         const float_type improv_percent = get_percentage(diff, baseline);
-         cell_str += " (" + get_num_str(improv_percent, 2, true) + "%)";
-         return cell_str;
-      }
+#define DT_STRINGIFY_IMPL(x) #x
+#define DT_STRINGIFY(x) DT_STRINGIFY_IMPL(x)
+   [[nodiscard]] inline auto get_clock_str() -> const char* {
+#if defined(DT_CLOCK)
+      return DT_STRINGIFY(DT_CLOCK);
+#elif defined(DT_TSC) && defined(DT_HAS_TSC)
+      return TscClock::s_usable.load() ? "tsc" : "steady_clock (no invariant tsc)";
+#else
+      return "steady_clock";
+#endif
+   }
 
 
-      struct TableRow {
-         std::vector<std::string> cells;
-         int max_width = 3;
-      };
+   // Calls fun(field, value) with everything about the measurement that isn't
+   // in the config. Values are numbers, bools or strings.
+   template<class Fun>
+   inline auto for_each_meta_field(const Results& presults, Fun&& fun) -> void {
+      fun("clock", get_clock_str());
+      fun("ms_per_tick", presults.ms_per_tick);
+      fun("timezone_overhead_ms", presults.timezone_overhead_ms);
+      fun("thread_count", presults.thread_count);
+#ifdef DT_THREADSAFE
+      fun("hardware_threads", static_cast<size_t>(std::thread::hardware_concurrency()));
+#endif // DT_THREADSAFE
+      fun("float_bits", 8 * sizeof(float_type));
+#if defined(_WIN32)
+      fun("platform", "windows");
+#elif defined(__APPLE__)
+      fun("platform", "apple");
+#elif defined(__linux__)
+      fun("platform", "linux");
+#else
+      fun("platform", "unknown");
+#endif
+#if defined(__clang__)
+      fun("compiler", "clang " __clang_version__);
+#elif defined(__GNUC__)
+      fun("compiler", "gcc " __VERSION__);
+#elif defined(_MSC_VER)
+      fun("compiler", "msvc " DT_STRINGIFY(_MSC_VER));
+#else
+      fun("compiler", "unknown");
+#endif
+   }
+#undef DT_STRINGIFY
+#undef DT_STRINGIFY_IMPL
+
+
+   template<class Fun>
+   inline auto for_each_config_field(const Config& pconfig, Fun&& fun) -> void {
+      fun("report_time_mode", get_enum_str(pconfig.report_time_mode));
+      fun("target_sample_count", pconfig.target_sample_count);
+      fun("target_ci_width", pconfig.target_ci_width);
+      fun("min_sample_count", pconfig.min_sample_count);
+      fun("max_sample_count", pconfig.max_sample_count);
+      fun("warmup_runs", pconfig.warmup_runs);
+      fun("percentiles", pconfig.percentiles);
+      fun("bootstrap_resamples", pconfig.bootstrap_resamples);
+      fun("sample_storage", get_enum_str(pconfig.sample_storage));
+      fun("sketch_accuracy", pconfig.sketch_accuracy);
+      fun("interaction_mode", get_enum_str(pconfig.interaction_mode));
+      fun("max_pairwise_zones", pconfig.max_pairwise_zones);
+      fun("virtual_speedup", pconfig.virtual_speedup);
+      fun("workload_fractions", pconfig.workload_fractions);
+      fun("trace_capacity", pconfig.trace_capacity);
+      fun("outlier_policy", get_enum_str(pconfig.outlier_policy));
+      fun("outlier_threshold", pconfig.outlier_threshold);
+      fun("trim_fraction", pconfig.trim_fraction);
+      fun("significance_test", get_enum_str(pconfig.significance_test));
+      fun("significance_level", pconfig.significance_level);
+      fun("schedule_mode", get_enum_str(pconfig.schedule_mode));
+      fun("interleave_block_size", pconfig.interleave_block_size);
+      fun("switch_warmup_runs", pconfig.switch_warmup_runs);
+      fun("subtract_timezone_overhead", pconfig.subtract_timezone_overhead);
+      fun("keep_raw_ticks", pconfig.keep_raw_ticks);
+      fun("async_evaluation", pconfig.async_evaluation);
+   }
 
-      struct ResultTable {
-         TableRow median, mean, worst, std_dev, zonetime_median;
-      };
 
+   // Everything but the name. frame_times and zone_times are in ms and sorted,
+   // without the rejected outliers. frame_ticks and zone_ticks are what was
+   // recorded, in that order, and empty without Config::keep_raw_ticks. With
+   // SampleStorage::Sketch, all four are empty.
+   template<class Fun>
+   inline auto for_each_result_field(const ZoneResult& result, Fun&& fun) -> void {
+      fun("median", result.median);
+      fun("zonetime_median", result.zonetime_median);
+      fun("mean", result.mean);
+      fun("worst_time", result.worst_time);
+      fun("std_dev", result.std_dev);
+      fun("percentiles", result.percentiles);
+      fun("ci_low", result.ci_low);
+      fun("ci_high", result.ci_high);
+      fun("p_value", result.p_value);
+      fun("rejected_count", result.rejected_count);
+      fun("parent", result.parent);
+      fun("inclusive_delta", result.inclusive_delta);
+      fun("exclusive_delta", result.exclusive_delta);
+      fun("thread_zonetime_means", result.thread_zonetime_means);
+      fun("frame_times", result.sorted_frame_times.get());
+      fun("zone_times", result.sorted_zone_times.get());
+      fun("frame_ticks", result.frame_ticks);
+      fun("zone_ticks", result.zone_ticks);
+   }
 
-      [[nodiscard]] inline auto get_table_row(
-         const std::vector<ZoneResult>& zone_results,
-         const EvalType eval_type,
-         const ReportTimeMode time_mode
-      ) -> TableRow {
-         TableRow row;
-         row.cells.reserve(zone_results.size());
-         for (int i = 0; i < zone_results.size(); ++i) {
-            const std::string cell_str = get_cell_str(zone_results[i], zone_results[0], i==0, eval_type, time_mode);
-            row.max_width = std::max(row.max_width, static_cast<int>(cell_str.length()));
-            row.cells.emplace_back(std::move(cell_str));
+
+   // With digits10 digits if they read back as the same value, otherwise with
+   // max_digits10. Keeps 0.05 from turning into 0.050000000000000003.
+   template<class T>
+   inline auto write_float(FILE* file, const T value) -> void {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.*g", std::numeric_limits<T>::digits10, static_cast<double>(value));
+      if (static_cast<T>(strtod(buffer, nullptr)) != value)
+         snprintf(buffer, sizeof(buffer), "%.*g", std::numeric_limits<T>::max_digits10, static_cast<double>(value));
+      fputs(buffer, file);
+   }
+
+
+   template<class T>
+   struct is_vector : std::false_type {};
+   template<class T>
+   struct is_vector<std::vector<T>> : std::true_type {};
+
+
+   template<class T>
+   inline auto write_json_value(FILE* file, const T& value) -> void {
+      if constexpr (std::is_same_v<T, bool>) {
+         fputs(value ? "true" : "false", file);
+      }
+      else if constexpr (std::is_integral_v<T>) {
+         fprintf(file, "%lld", static_cast<long long>(value));
+      }
+      else if constexpr (std::is_floating_point_v<T>) {
+         if (std::isfinite(value))
+            write_float(file, value);
+         else
+            fputs("null", file); // JSON has no inf or nan
+      }
+      else if constexpr (is_vector<T>::value) {
+         fputc('[', file);
+         for (size_t i = 0; i < value.size(); ++i) {
+            if (i > 0)
+               fputc(',', file);
+            write_json_value(file, value[i]);
          }
-         return row;
+         fputc(']', file);
+      }
+      else {
+         write_json_string(file, value);
       }
+   }
 
 
-      [[nodiscard]] inline auto get_result_table(
-         const std::vector<ZoneResult>& zone_results,
-         const ReportTimeMode time_mode
-      ) -> ResultTable {
-         return {
-            get_table_row(zone_results, EvalType::Median, time_mode),
-            get_table_row(zone_results, EvalType::Mean, time_mode),
-            get_table_row(zone_results, EvalType::Worst, time_mode),
-            get_table_row(zone_results, EvalType::StdDev, time_mode),
-            get_table_row(zone_results, EvalType::ZonetimeMedian, time_mode)
-         };
+   // Writes the fields of an object without the braces, the first one
+   // without a leading comma
+   struct JsonFieldWriter {
+      FILE* file;
+      bool first = true;
+
+      template<class T>
+      auto operator()(const char* field, const T& value) -> void {
+         fprintf(file, first ? "\"%s\":" : ",\"%s\":", field);
+         write_json_value(file, value);
+         first = false;
       }
+   };
 
 
-      inline auto get_united_str(
-         const std::string& description,
-         const Config& pconfig
-      ) -> std::string {
-         std::string s = description;
-         if (pconfig.report_time_mode == ReportTimeMode::Fps)
-            s += "[FPS]";
-         else
-            s += "[ms]";
-         return s;
+   inline auto write_json_result(FILE* file, const ZoneResult& result) -> void {
+      JsonFieldWriter writer{ file };
+      fputc('{', file);
+      writer("name", result.name);
+      for_each_result_field(result, writer);
+      fputc('}', file);
+   }
+
+
+   inline auto write_json_results(FILE* file, const std::vector<ZoneResult>& zone_results) -> void {
+      fputc('[', file);
+      for (size_t i = 0; i < zone_results.size(); ++i) {
+         fputs(i == 0 ? "\n" : ",\n", file);
+         write_json_result(file, zone_results[i]);
       }
+      fputs("\n]", file);
+   }
 
 
-      inline auto header_print(
-         char* buffer,
-         const size_t buffer_len,
-         const int name_col_len,
-         const ResultTable& table,
-         const Config& pconfig
-      ) -> int {
-         return snprintf(
-            buffer,
-            buffer_len,
-            "%*s %-*s %-*s %-*s %-*s %-*s\n",
-            name_col_len, "",
-            table.median.max_width, get_united_str("median", pconfig).c_str(),
-            table.mean.max_width, get_united_str("mean", pconfig).c_str(),
-            table.worst.max_width, get_united_str("worst", pconfig).c_str(),
-            table.std_dev.max_width, "std dev[%]",
-            table.zonetime_median.max_width, "ztm"
-         );
+   // Streamed into the file, the document is never in memory as a whole
+   inline auto write_results_json(
+      FILE* file,
+      const Results& presults
+   ) -> void {
+      fputs("{\n\"meta\":{", file);
+      for_each_meta_field(presults, JsonFieldWriter{ file });
+      fputs("},\n\"config\":{", file);
+      for_each_config_field(presults.config, JsonFieldWriter{ file });
+      fputs("},\n\"zone_results\":", file);
+      write_json_results(file, presults.zone_results);
+      fputs(",\n\"interaction_results\":[", file);
+      for (size_t i = 0; i < presults.interaction_results.size(); ++i) {
+         const InteractionResult& interaction = presults.interaction_results[i];
+         fputs(i == 0 ? "\n" : ",\n", file);
+         JsonFieldWriter writer{ file };
+         fputc('{', file);
+         writer("zone_a", interaction.zone_a);
+         writer("zone_b", interaction.zone_b);
+         writer("interaction", interaction.interaction);
+         fputs(",\"result\":", file);
+         write_json_result(file, interaction.result);
+         fputc('}', file);
+      }
+      fputs("\n],\n\"speedup_results\":", file);
+      write_json_results(file, presults.speedup_results);
+      fputs(",\n\"variant_results\":", file);
+      write_json_results(file, presults.variant_results);
+      fputs(",\n\"workload_results\":[", file);
+      for (size_t i = 0; i < presults.workload_results.size(); ++i) {
+         const WorkloadResult& workload = presults.workload_results[i];
+         fputs(i == 0 ? "\n" : ",\n", file);
+         JsonFieldWriter writer{ file };
+         fputc('{', file);
+         writer("name", workload.name);
+         writer("cost", workload.cost);
+         writer("cost_ci", workload.cost_ci);
+         writer("fixed_time", workload.fixed_time);
+         fputs(",\"fraction_results\":", file);
+         write_json_results(file, workload.fraction_results);
+         fputc('}', file);
       }
+      fputs("\n]\n}\n", file);
+   }
 
 
-      inline auto row_print(
-         char* buffer,
-         const size_t buffer_len,
-         const int name_col_len,
-         const std::string& name_col,
-         const ResultTable& table,
-         const int i
-      ) -> int {
-         return snprintf(
-            buffer,
-            buffer_len,
-            "%-*s %-*s %-*s %-*s %-*s %-*s\n",
-            name_col_len,
-            name_col.c_str(),
-            table.median.max_width, table.median.cells[i].c_str(),
-            table.mean.max_width, table.mean.cells[i].c_str(),
-            table.worst.max_width, table.worst.cells[i].c_str(),
-            table.std_dev.max_width, table.std_dev.cells[i].c_str(),
-            table.zonetime_median.max_width, table.zonetime_median.cells[i].c_str()
-         );
+   // Quoted only if needed (RFC 4180)
+   inline auto write_csv_string(FILE* file, const std::string& str) -> void {
+      if (str.find_first_of(",\"\r\n") == std::string::npos) {
+         fputs(str.c_str(), file);
+         return;
       }
+      fputc('"', file);
+      for (const char c : str) {
+         if (c == '"')
+            fputc('"', file);
+         fputc(c, file);
+      }
+      fputc('"', file);
+   }
 
 
-      inline auto get_result_str(
-         const std::vector<ZoneResult>& zone_results,
-         const Config& pconfig
-      ) -> std::string {
-         const char* wo_prefix = "w/o ";
-         int name_col_len = get_max_zone_name_len(zone_results, 3);
-         name_col_len += static_cast<int>(strlen(wo_prefix));
-         name_col_len += 1; // for colon
-         constexpr int decimal_places = 1;
-         const ResultTable table = get_result_table(zone_results, pconfig.report_time_mode);
+   // One row per value, vectors get one row per element with their index
+   struct CsvRowWriter {
+      FILE* file;
+      const char* section;
+      const std::string* name;
 
-         std::string output_str;
-         {
-            const int header_buf_len = header_print(nullptr, 0, name_col_len, table, pconfig);
-            output_str.resize(header_buf_len + 1);
-         }
-
-         header_print(&output_str.front(), output_str.size(), name_col_len, table, pconfig);
-         output_str.pop_back(); // remove null terminator
-
-         for (int i = 0; i < zone_results.size(); ++i) {
-            const ZoneResult& result = zone_results[i];
-            std::string name_col = "all";
-            if (i != 0)
-               name_col = wo_prefix + result.name;
-            name_col += ":";
-            {
-               const int row_size = row_print(nullptr, 0, name_col_len, name_col, table, i);
-               const size_t old_size = output_str.size();
-               output_str.resize(old_size + row_size + 1);
-               row_print(&output_str[old_size], row_size + 1, name_col_len, name_col, table, i);
+      template<class T>
+      auto operator()(const char* field, const T& value) -> void {
+         if constexpr (is_vector<T>::value) {
+            for (size_t i = 0; i < value.size(); ++i) {
+               write_row_start(field);
+               fprintf(file, "%zu,", i);
+               write_value(value[i]);
             }
-            output_str.pop_back(); // remove null terminator
          }
-         output_str.push_back('\0');
-         return output_str;
+         else {
+            write_row_start(field);
+            fputc(',', file);
+            write_value(value);
+         }
       }
 
-   } // namespace printing
+   private:
+      auto write_row_start(const char* field) -> void {
+         fprintf(file, "%s,", section);
+         write_csv_string(file, *name);
+         fprintf(file, ",%s,", field);
+      }
 
+      template<class T>
+      auto write_value(const T& value) -> void {
+         if constexpr (std::is_floating_point_v<T>) {
+            write_float(file, value);
+            fputc('\n', file);
+         }
+         else if constexpr (std::is_same_v<T, bool>)
+            fputs(value ? "true\n" : "false\n", file);
+         else if constexpr (std::is_integral_v<T>)
+            fprintf(file, "%lld\n", static_cast<long long>(value));
+         else {
+            write_csv_string(file, value);
+            fputc('\n', file);
+         }
+      }
+   };
 
-   inline auto ensure_null_zone(
-      State& state,
-      const Config& pconfig
+
+   // Long format, i.e. one value per row, so that every part fits into the
+   // same columns: section,name,field,index,value
+   inline auto write_results_csv(
+      FILE* file,
+      const Results& presults
    ) -> void {
-		if (state.zones.empty()) {
-         state.zones.emplace_back();
-         state.zones.back().frame_times.reserve(pconfig.target_sample_count);
-		}
+      const std::string no_name;
+      fputs("section,name,field,index,value\n", file);
+      for_each_meta_field(presults, CsvRowWriter{ file, "meta", &no_name });
+      for_each_config_field(presults.config, CsvRowWriter{ file, "config", &no_name });
+      const auto write_results = [&](const char* section, const std::vector<ZoneResult>& zone_results) {
+         for (const ZoneResult& result : zone_results)
+            for_each_result_field(result, CsvRowWriter{ file, section, &result.name });
+      };
+      write_results("zone", presults.zone_results);
+      for (const InteractionResult& interaction : presults.interaction_results) {
+         CsvRowWriter writer{ file, "interaction", &interaction.result.name };
+         writer("zone_a", interaction.zone_a);
+         writer("zone_b", interaction.zone_b);
+         writer("interaction", interaction.interaction);
+         for_each_result_field(interaction.result, writer);
+      }
+      write_results("speedup", presults.speedup_results);
+      write_results("variant", presults.variant_results);
+      for (const WorkloadResult& workload : presults.workload_results) {
+         CsvRowWriter writer{ file, "workload", &workload.name };
+         writer("cost", workload.cost);
+         writer("cost_ci", workload.cost_ci);
+         writer("fixed_time", workload.fixed_time);
+         write_results("workload_fraction", workload.fraction_results);
+      }
    }
 
 
-   inline auto evaluate(
-      Results& presults,
-      const Config& pconfig,
-      const State& pstate
-   ) -> void {
-      presults.zone_results = get_zone_results(pstate.zones);
-      presults.result_str = printing::get_result_str(presults.zone_results, pconfig);
-      if (pconfig.report_out_mode == ReportOutMode::ConsoleOut)
-         printf("%s", presults.result_str.c_str());
+} // namespace dt::details
 
-      if (pconfig.done_cb != nullptr)
-         pconfig.done_cb(results.zone_results);
+
+inline auto dt::SortedTimes::get() const -> const std::vector<float_type>& {
+   if (!m_sorted) {
+      std::sort(std::begin(m_times), std::end(m_times));
+      m_sorted = true;
    }
+   return m_times;
+}
 
-} // namespace dt::details
+
+#ifndef DT_DISABLE
+inline dt::ZoneHandle::ZoneHandle(const std::string& zone_name)
+   : m_name(zone_name)
+   , m_slot(get_slot(details::get_or_add_zone_index(zone_name, dt_state, config), dt_state.generation))
+{}
+
+
+inline auto dt::ZoneHandle::get_slot(
+   const size_t index,
+   const int generation
+) -> std::uint64_t {
+   return static_cast<std::uint64_t>(static_cast<std::uint32_t>(generation)) << 32 | static_cast<std::uint32_t>(index);
+}
+
+
+inline auto dt::ZoneHandle::active() -> bool {
+   return details::is_nested_zone_active(get_index());
+}
+
+
+inline auto dt::ZoneHandle::get_index() -> size_t {
+   const int generation = dt_state.generation.load(std::memory_order_relaxed);
+   const std::uint64_t slot = m_slot.load(std::memory_order_relaxed);
+   if (slot >> 32 == static_cast<std::uint32_t>(generation))
+      return static_cast<size_t>(slot & 0xffff'ffff);
+   // factory_reset() since last use. Threads that race here register the same zone.
+   const size_t index = details::get_or_add_zone_index(m_name, dt_state, config);
+   m_slot.store(get_slot(index, generation), std::memory_order_relaxed);
+   return index;
+}
 
 
 inline bool dt::zone(const std::string& zone_name) {
-   details::ensure_null_zone(dt_state, config);
+   return details::is_nested_zone_active(details::get_or_add_zone_index(zone_name, dt_state, config));
+}
 
-   if (!details::is_zone_known(zone_name, dt_state)) {
-      dt_state.zones.push_back({ zone_name, {} });
-      dt_state.zones.back().frame_times.reserve(config.target_sample_count);
-   }
-   
-   if (dt_state.status == Status::Measuring) {
-      const size_t current_zone = details::get_zone_index(zone_name, dt_state);
-      if (dt_state.target_zone == 0)
-         return true;
-      return current_zone != dt_state.target_zone;
-   }
-   return true;
+
+inline bool dt::zone(ZoneHandle& handle) {
+   return handle.active();
+}
+
+
+inline bool dt::zone(const ZoneId& id) {
+   return details::is_nested_zone_active(details::get_or_add_zone_index(id, dt_state, config));
 }
 
 
 [[nodiscard]]
 inline auto dt::timezone(const std::string& zone_name) -> details::ZoneGuard {
-   details::ensure_null_zone(dt_state, config);
+   const size_t zone_index = details::get_or_add_zone_index(zone_name, dt_state, config);
+   return details::get_zone_guard(zone_index, dt_state);
+}
 
-   if (!details::is_zone_known(zone_name, dt_state)) {
-      dt_state.zones.push_back({ zone_name, {} });
-      dt_state.zones.back().frame_times.reserve(config.target_sample_count);
-   }
 
-   if (dt_state.status == Status::Measuring) {
-      const size_t zone_index = details::get_zone_index(zone_name, dt_state);
-      if (zone_index == 0)
-         return details::ZoneGuard{ -1 };
-      return details::ZoneGuard{ static_cast<ptrdiff_t>(zone_index) };
-   }
+[[nodiscard]]
+inline auto dt::timezone(ZoneHandle& handle) -> details::ZoneGuard {
+   return details::get_zone_guard(handle.get_index(), dt_state);
+}
 
-   return details::ZoneGuard{ -1 };
+
+[[nodiscard]]
+inline auto dt::timezone(const ZoneId& id) -> details::ZoneGuard {
+   return details::get_zone_guard(details::get_or_add_zone_index(id, dt_state, config), dt_state);
 }
 
 
-inline void dt::start() {
-   if (dt_state.status == Status::Ready)
-      dt_state.status = Status::Starting;
+// Returns 0 unless one of the other variants is measured
+inline auto dt::variant(
+   const std::string& variant_name,
+   const int variant_count
+) -> int {
+   const size_t index = details::get_or_add_variant_index(variant_name, variant_count, dt_state, config);
+   const TargetConfig& target = details::get_target(dt_state);
+   if (index + 1 != target.target_variant)
+      return 0;
+   return target.variant_choice;
 }
 
 
-inline void dt::slice(const float_type time_delta_ms) {
-   if (dt_state.status == Status::Ready) {
+// Returns 1 unless one of the fractions is measured
+inline auto dt::workload(const std::string& workload_name) -> float_type {
+   const size_t index = details::get_or_add_workload_index(workload_name, dt_state, config);
+   const TargetConfig& target = details::get_target(dt_state);
+   if (index + 1 != target.target_workload)
+      return static_cast<float_type>(1.0);
+   return target.workload_fraction;
+}
+
+
+// The calibration and seeding happen under the lock, so that a concurrent
+// start() or slice() never sees them half done
+inline void dt::start() {
+   const details::ScopedLock lock(dt_state.mutex);
+   if (dt_state.status != Status::Ready)
       return;
-   }
-   else if (dt_state.status == Status::Starting) {
-      details::reset_state(dt_state);
-      dt_state.status = Status::Measuring;
-   }
-   else if (dt_state.status == Status::Measuring) {
-      if (dt_state.warmup_runs_left > 0) {
-         --dt_state.warmup_runs_left;
-         return;
-      }
-      details::record_slice(dt_state, time_delta_ms);
-      for (Zone& zone : dt_state.zones)
-         zone.zone_buffer = static_cast<float_type>(0.0);
-      if (details::is_sample_target_reached(dt_state, config)) {
-         details::start_next_zone_measurement(dt_state);
-         if (details::are_all_zones_done(dt_state)) {
-            details::evaluate(results, config, dt_state);
-            dt_state.status = Status::Ready;
-         }
-      }
-   }
+   dt_state.ms_per_tick = details::clock_type::calibrate();
+   dt_state.rng_state = static_cast<std::uint64_t>(details::clock_type::now());
+   Status expected = Status::Ready; // the async evaluation publishes Ready without the lock
+   dt_state.status.compare_exchange_strong(expected, Status::Starting);
 }
 
 
+inline void dt::slice(const float_type time_delta_ms) {
+   details::process_slice(dt_state, config, results, details::get_ticks_from_ms(time_delta_ms, dt_state.ms_per_tick));
+}
+
 
 #ifndef DT_NO_CHRONO
 inline void dt::slice() {
-   float_type time_delta_ms = 0.0;
+   std::int64_t frame_ticks = 0;
    if (dt_state.status == Status::Starting) {
-      dt_state.t0 = std::chrono::high_resolution_clock::now();
+      dt_state.t0 = details::clock_type::now();
    }
    else if (dt_state.status == Status::Measuring) {
-      const auto t1 = std::chrono::high_resolution_clock::now();
-      time_delta_ms = details::get_ms_from_dt(t1, dt_state.t0);
+      const std::int64_t t1 = details::clock_type::now();
+      frame_ticks = t1 - dt_state.t0;
+      if (details::is_null_run(details::get_target(dt_state)))
+         details::record_trace_event(dt_state, details::get_thread_buffer(dt_state), 0, dt_state.t0, t1);
       dt_state.t0 = t1;
    }
-   slice(time_delta_ms);
+   details::process_slice(dt_state, config, results, frame_ticks);
 }
 #endif // DT_NO_CHRONO
+#endif // DT_DISABLE
 
 
 inline auto dt::set_sample_count(const int sample_count) -> void {
@@ -642,6 +3751,22 @@ inline auto dt::set_sample_count(const int sample_count) -> void {
 }
 
 
+// Keeps measuring each zone until the 95% confidence interval of its mean
+// difference to the baseline is narrower than target_ci_width (relative to the
+// baseline mean). 0 goes back to the fixed sample count. The CI needs at least
+// 2 samples, so min_sample_count is raised to 2 and max_sample_count to
+// min_sample_count if needed.
+inline auto dt::set_adaptive_sample_count(
+   const float_type target_ci_width,
+   const int min_sample_count,
+   const int max_sample_count
+) -> void {
+   config.target_ci_width = target_ci_width;
+   config.min_sample_count = std::max(min_sample_count, 2);
+   config.max_sample_count = std::max(max_sample_count, config.min_sample_count);
+}
+
+
 inline auto dt::set_warmup_runs(const int warmup_runs) -> void {
    dt::config.warmup_runs = warmup_runs;
 }
@@ -662,19 +3787,188 @@ inline auto dt::set_done_callback(DoneCallback cb) -> void {
 }
 
 
+inline auto dt::set_bootstrap_resamples(const int resamples) -> void {
+   config.bootstrap_resamples = resamples;
+}
+
+
+inline auto dt::set_percentiles(const std::vector<float_type>& percentiles) -> void {
+   config.percentiles = percentiles;
+}
+
+
+inline auto dt::set_sample_storage(
+   const SampleStorage sample_storage,
+   const float_type sketch_accuracy
+) -> void {
+   config.sample_storage = sample_storage;
+   config.sketch_accuracy = sketch_accuracy;
+}
+
+
+inline auto dt::set_significance_test(
+   const SignificanceTest test,
+   const float_type significance_level
+) -> void {
+   config.significance_test = test;
+   config.significance_level = significance_level;
+}
+
+
+inline auto dt::set_outlier_policy(
+   const OutlierPolicy policy,
+   const float_type threshold
+) -> void {
+   config.outlier_policy = policy;
+   // the trimmed fraction is a different unit, a threshold like 3.5 would trim everything
+   if (policy == OutlierPolicy::TrimmedMean)
+      config.trim_fraction = std::clamp(threshold, static_cast<float_type>(0.0), static_cast<float_type>(0.49));
+   else if (policy != OutlierPolicy::None)
+      config.outlier_threshold = std::max(threshold, static_cast<float_type>(0.0));
+}
+
+
+inline auto dt::set_interaction_mode(const InteractionMode interaction_mode) -> void {
+   config.interaction_mode = interaction_mode;
+}
+
+
+inline auto dt::set_max_pairwise_zones(const size_t max_zones) -> void {
+   config.max_pairwise_zones = std::clamp<size_t>(max_zones, 2, 63);
+}
+
+
+inline auto dt::set_virtual_speedup(const float_type speedup) -> void {
+   const bool valid = speedup > static_cast<float_type>(0.0) && speedup < static_cast<float_type>(1.0);
+   config.virtual_speedup = valid ? speedup : static_cast<float_type>(0.0);
+}
+
+
+// Fractions outside of [0, 1) and duplicates are dropped. Without any valid
+// one left, the fractions stay as they were.
+inline auto dt::set_workload_fractions(const std::vector<float_type>& fractions) -> void {
+   std::vector<float_type> valid = details::get_valid_workload_fractions(fractions);
+   if (!valid.empty())
+      config.workload_fractions = std::move(valid);
+}
+
+
+// The frames and timezones of the baseline are recorded into a ring of that
+// many events, which dt::write_trace_json() writes out after a measurement
+inline auto dt::set_trace_capacity(const size_t event_count) -> void {
+   config.trace_capacity = event_count;
+}
+
+
+// Returns false if the file couldn't be opened
+inline auto dt::write_trace_json(const std::string& path) -> bool {
+   // copied with the lock, written without it
+   std::vector<details::TraceEvent> events;
+   std::vector<std::string> zone_names;
+   size_t thread_count = 0;
+   double ms_per_tick = 0.0;
+   {
+      const details::ScopedLock lock(dt_state.mutex);
+      events = details::get_trace_events(dt_state.trace);
+      if (const Registry* registry = dt_state.registry.load())
+         zone_names = registry->names;
+      thread_count = dt_state.thread_buffers.size();
+      ms_per_tick = dt_state.ms_per_tick;
+   }
+   FILE* file = fopen(path.c_str(), "w");
+   if (file == nullptr)
+      return false;
+   details::write_trace_events(file, events, zone_names, thread_count, ms_per_tick);
+   return fclose(file) == 0;
+}
+
+
+// Writes dt::results with the config that produced them. Returns false if the file
+// couldn't be opened or an evaluation is still running.
+inline auto dt::write_results_json(const std::string& path) -> bool {
+   if (dt_state.status == Status::Evaluating)
+      return false;
+   FILE* file = fopen(path.c_str(), "w");
+   if (file == nullptr)
+      return false;
+   details::write_results_json(file, results);
+   return fclose(file) == 0;
+}
+
+
+// Same content as dt::write_results_json()
+inline auto dt::write_results_csv(const std::string& path) -> bool {
+   if (dt_state.status == Status::Evaluating)
+      return false;
+   FILE* file = fopen(path.c_str(), "w");
+   if (file == nullptr)
+      return false;
+   details::write_results_csv(file, results);
+   return fclose(file) == 0;
+}
+
+
+inline auto dt::set_schedule_mode(const ScheduleMode schedule_mode) -> void {
+   config.schedule_mode = schedule_mode;
+}
+
+
+inline auto dt::set_interleave_block_size(const int max_block_size) -> void {
+   config.interleave_block_size = max_block_size;
+}
+
+
+inline auto dt::set_switch_warmup_runs(const int switch_warmup_runs) -> void {
+   config.switch_warmup_runs = switch_warmup_runs;
+}
+
+
+inline auto dt::set_async_evaluation(const bool async_evaluation) -> void {
+   config.async_evaluation = async_evaluation;
+}
+
+
+inline auto dt::set_timezone_overhead_subtraction(const bool subtract) -> void {
+   config.subtract_timezone_overhead = subtract;
+}
+
+
+inline auto dt::set_raw_tick_keeping(const bool keep) -> void {
+   config.keep_raw_ticks = keep;
+}
+
+
 inline auto dt::are_results_ready() -> bool {
-   return dt_state.status == Status::Ready && dt_state.recorded_slices > 0;
+   return dt_state.status == Status::Ready && !results.zone_results.empty();
 }
 
 
 inline auto dt::clear_results() -> void {
-   results.zone_results.clear();
-   results.result_str.clear();
+#ifdef DT_THREADSAFE
+   dt_state.evaluation_thread.join(); // its done callback may still read them
+#endif // DT_THREADSAFE
+   results = Results{};
 }
 
 
+// Must not run concurrently with zone calls on other threads
 inline auto dt::factory_reset() -> void {
+#ifdef DT_THREADSAFE
+   dt_state.evaluation_thread.join();
+#endif // DT_THREADSAFE
+   const details::ScopedLock lock(dt_state.mutex);
    dt_state.zones.clear();
+   dt_state.registry = nullptr;
+   dt_state.registry_versions = {};
+   dt_state.target = &details::null_target_config;
+   dt_state.target_snapshots.clear();
+   dt_state.variants.clear();
+   dt_state.workloads.clear();
+   dt_state.thread_buffers.clear();
+   dt_state.trace.storage = nullptr;
+   dt_state.trace.storages = {};
+   dt_state.trace.next = 0;
+   ++dt_state.generation;
    dt_state.status = Status::Ready;
    details::reset_state(dt_state);
    clear_results();
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Compiles disabled_test.cpp and fails unless the -O2 assembly of
+# codegen_with_dt() and codegen_without_dt() is identical, i.e. DT_DISABLE
+# leaves no code behind. Labels and debug directives are ignored.
+set -e
+CXX=${CXX:-g++}
+dir=$(dirname "$0")
+asm=$("$CXX" -std=c++17 -O2 -S -o - "$dir/disabled_test.cpp")
+
+body() {
+   printf '%s\n' "$asm" \
+      | awk -v name="$1" '$0 == name ":" { found = 1; next } found && /^\t\.(cfi_endproc|size)/ { exit } found' \
+      | grep -v -e '^\.L' -e '^[[:space:]]*\.cfi' -e '^[[:space:]]*\.p2align'
+}
+
+with_dt=$(body codegen_with_dt)
+without_dt=$(body codegen_without_dt)
+if [ -z "$with_dt" ] || [ "$with_dt" != "$without_dt" ]; then
+   echo "DT_DISABLE changes the codegen:"
+   echo "--- with dt"
+   echo "$with_dt"
+   echo "--- without dt"
+   echo "$without_dt"
+   exit 1
+fi
+echo "identical codegen with DT_DISABLE"
@@ -0,0 +1,64 @@
+// Checks that DT_DISABLE leaves nothing behind. The calls are checked to be
+// constant expressions at compile time, so the branches around them fold
+// away. disabled_codegen_test.sh checks that the -O2 assembly of
+// codegen_with_dt() and codegen_without_dt() is identical.
+#define DT_DISABLE
+#include "../dt.h"
+
+#include <type_traits>
+
+
+static_assert(dt::zone("draw shadows"));
+static_assert(DT_ZONE("draw shadows"));
+static_assert(dt::ZoneHandle("draw shadows").active());
+static_assert(dt::timezone("draw shadows"));
+static_assert(DT_TIMEZONE("draw shadows"));
+static_assert(std::is_empty_v<decltype(dt::timezone("draw shadows"))>);
+static_assert(dt::variant("culling", 2) == 0);
+
+
+constexpr auto with_dt(int x) -> int {
+   dt::start();
+   if (dt::zone("first"))
+      x += 1;
+   if (DT_ZONE("second"))
+      x *= 2;
+   if (auto guard = dt::timezone("third"))
+      x -= 3;
+   dt::slice();
+   dt::slice(16.6f);
+   return x;
+}
+
+
+constexpr auto without_dt(int x) -> int {
+   x += 1;
+   x *= 2;
+   x -= 3;
+   return x;
+}
+
+
+static_assert(with_dt(5) == without_dt(5));
+
+
+// For disabled_codegen_test.sh, the x is only known at runtime
+extern "C" auto codegen_with_dt(const int x) -> int {
+   return with_dt(x);
+}
+
+
+extern "C" auto codegen_without_dt(const int x) -> int {
+   return without_dt(x);
+}
+
+
+int main() {
+   // Runtime doesn't touch the global state either
+   const std::string name = "runtime name";
+   dt::start();
+   static dt::ZoneHandle handle(name);
+   const bool active = dt::zone(name) && dt::zone(handle);
+   dt::slice();
+   return (active && dt::dt_state.zones.empty()) ? 0 : 1;
+}
@@ -1,6 +1,9 @@
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <thread>
 
+// threadsafe_tests.cpp includes this again with DT_THREADSAFE
 #include "../dt.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT
@@ -9,12 +12,47 @@
 #pragma warning( pop )
 
 
-TEST_CASE("get_ms_from_dt()") {
-	constexpr std::chrono::microseconds t0{ 3 };
-	constexpr std::chrono::microseconds t1{ 1003 };
-	constexpr std::chrono::high_resolution_clock::time_point tp0(t0);
-	constexpr std::chrono::high_resolution_clock::time_point tp1(t1);
-	CHECK_EQ(dt::details::get_ms_from_dt(tp1, tp0), doctest::Approx(1));
+TEST_CASE("clocks") {
+	CHECK_EQ(dt::details::ChronoClock::calibrate(), doctest::Approx(1e-6));
+	CHECK_EQ(dt::details::get_ms_from_ticks(2'000'000, 1e-6), doctest::Approx(2.0));
+#ifdef DT_HAS_TSC
+	// calibration is only as good as the clock it's checked against
+	const double ms_per_tick = dt::details::TscClock::calibrate();
+	const std::int64_t t0 = dt::details::TscClock::now();
+	const auto c0 = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - c0 < std::chrono::milliseconds(20)) {}
+	const double ms = dt::details::get_ms_from_ticks(dt::details::TscClock::now() - t0, ms_per_tick);
+	CHECK_EQ(ms, doctest::Approx(20.0).epsilon(0.1));
+#endif
+}
+
+TEST_CASE("measure_timezone_overhead()") {
+	dt::factory_reset();
+	const std::int64_t overhead = dt::details::measure_timezone_overhead();
+	CHECK_GT(overhead, 0);
+	// generous, but catches a broken measurement
+	CHECK_LT(dt::details::get_ms_from_ticks(overhead, dt::details::clock_type::calibrate()), 0.01);
+	// the empty guards leave nothing behind
+	const dt::details::PaddedTotal& total = dt::details::get_thread_total(dt::details::get_thread_buffer(dt::dt_state), 0);
+	CHECK_EQ(total.value, 0);
+	CHECK_EQ(total.count, 0);
+	dt::factory_reset();
+}
+
+TEST_CASE("timezones shorter than the overhead") {
+	dt::factory_reset();
+	const size_t index = dt::details::get_or_add_zone_index("short", dt::dt_state, dt::config);
+	dt::dt_state.timezone_overhead = 1'000'000'000;
+	dt::dt_state.status = dt::Status::Measuring; // timezones are inert otherwise
+	{
+		const auto guard = dt::timezone("short");
+	}
+	dt::details::merge_thread_buffers(dt::dt_state);
+	dt::details::record_slice(dt::dt_state, 16);
+	// recorded as 0 instead of dropped
+	CHECK_EQ(dt::dt_state.zones[index].zone_times, std::vector<std::int64_t>{ 0 });
+	dt::dt_state.timezone_overhead = 0;
+	dt::factory_reset();
 }
 
 TEST_CASE("get_median() empty") {
@@ -42,6 +80,30 @@ TEST_CASE("get_std_dev()") {
 	CHECK_EQ(dt::details::get_std_dev(v, mean), doctest::Approx(14.974));
 }
 
+TEST_CASE("get_moments()") {
+	// sizes that end in partial vectors and blocks
+	for (const size_t n : { 1, 2, 3, 7, 1023, 1025, 5000 }) {
+		std::vector<double> v;
+		for (size_t i = 0; i < n; ++i)
+			v.push_back(1e6 + static_cast<double>(i % 17) - 0.25 * static_cast<double>(i % 5));
+		long double sum = 0.0L;
+		for (const double value : v)
+			sum += value;
+		const long double mean = sum / n;
+		long double squares = 0.0L;
+		for (const double value : v)
+			squares += (value - mean) * (value - mean);
+
+		const dt::details::Moments moments = dt::details::get_moments(v);
+		CHECK_EQ(moments.count, n);
+		CHECK_EQ(moments.mean, doctest::Approx(static_cast<double>(mean)).epsilon(1e-14));
+		CHECK_EQ(moments.m2, doctest::Approx(static_cast<double>(squares)).epsilon(1e-9));
+		CHECK_EQ(dt::details::get_mean(v), doctest::Approx(moments.mean).epsilon(1e-14));
+		if (n > 1)
+			CHECK_EQ(dt::details::get_std_dev(v, moments.mean), doctest::Approx(std::sqrt(moments.m2 / (n - 1.0))));
+	}
+}
+
 TEST_CASE("auto_get_digits_before_point()") {
 	CHECK_EQ(dt::details::printing::auto_get_digits_before_point(99), 2);
 	CHECK_EQ(dt::details::printing::auto_get_digits_before_point(10), 2);
@@ -61,6 +123,8 @@ TEST_CASE("get_fractional_string()") {
 	CHECK_EQ(dt::details::printing::get_fractional_string(1.235, 3), "235");
 	CHECK_EQ(dt::details::printing::get_fractional_string(1.235, 1), "2");
 	CHECK_EQ(dt::details::printing::get_fractional_string(1.235, 1), "2");
+	CHECK_EQ(dt::details::printing::get_fractional_string(1.05, 2), "05");
+	CHECK_EQ(dt::details::printing::get_fractional_string(1.0, 2), "00");
 }
 
 TEST_CASE("get_num_str()") {
@@ -72,6 +136,9 @@ TEST_CASE("get_num_str()") {
 	CHECK_EQ(dt::details::printing::get_num_str(99.0, 4, true), "+99.00");
 	CHECK_EQ(dt::details::printing::get_num_str(0.110, 3, false), "0.110");
 	CHECK_EQ(dt::details::printing::get_num_str(0.111, 3, false), "0.111");
+	CHECK_EQ(dt::details::printing::get_num_str(4.02, 3, false), "4.02");
+	CHECK_EQ(dt::details::printing::get_num_str(4.99999, 3, false), "5.00");
+	CHECK_EQ(dt::details::printing::get_num_str(-0.99999, 3, true), "-1.00");
 }
 
 TEST_CASE("factory_reset()") {
@@ -84,6 +151,1084 @@ TEST_CASE("factory_reset()") {
 	CHECK_EQ(dt::dt_state.status, dt::Status::Ready);
 }
 
+TEST_CASE("ZoneHandle") {
+	dt::factory_reset();
+	dt::ZoneHandle handle("handle zone");
+	CHECK_EQ(handle.get_index(), 1);
+	CHECK(handle.active());
+	CHECK_EQ(dt::details::get_zone_index("handle zone", *dt::dt_state.registry.load()), 1);
+
+	dt::details::set_target_config(dt::dt_state, 1);
+	CHECK_FALSE(handle.active());
+	CHECK_FALSE(dt::zone("handle zone"));
+	dt::details::set_target_config(dt::dt_state, 0);
+
+	// handles re-register after a reset
+	dt::factory_reset();
+	dt::zone("other zone");
+	CHECK_EQ(handle.get_index(), 2);
+	dt::factory_reset();
+}
+
+TEST_CASE("DT_ZONE()") {
+	dt::factory_reset();
+	static_assert(dt::details::get_fnv1a_hash("") == 14695981039346656037ull);
+	static_assert(dt::details::get_fnv1a_hash("a") == 0xaf63dc4c8601ec8cull);
+	CHECK(DT_ZONE("hashed zone"));
+	CHECK(dt::zone("string zone"));
+	CHECK(DT_ZONE("string zone"));
+	CHECK_EQ(dt::dt_state.zones.size(), 3);
+	CHECK_EQ(dt::dt_state.registry.load()->table.used, 2);
+
+	// same name from a different literal finds the same zone
+	const char other_literal[] = "hashed zone";
+	const dt::ZoneId id{ dt::details::get_fnv1a_hash(other_literal), other_literal };
+	CHECK_EQ(dt::details::get_or_add_zone_index(id, dt::dt_state, dt::config), 1);
+
+	// a colliding hash falls back to the name
+	const dt::ZoneId collision{ id.hash, "collision" };
+	CHECK_EQ(dt::details::get_or_add_zone_index(collision, dt::dt_state, dt::config), 3);
+	CHECK_EQ(dt::details::get_or_add_zone_index(collision, dt::dt_state, dt::config), 3);
+
+	dt::details::set_target_config(dt::dt_state, 1);
+	CHECK_FALSE(DT_ZONE("hashed zone"));
+	dt::details::set_target_config(dt::dt_state, 0);
+	dt::factory_reset();
+}
+
+#ifdef DT_THREADSAFE
+TEST_CASE("threaded registration and merging") {
+	dt::factory_reset();
+	constexpr int thread_count = 4;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < thread_count; ++t) {
+		threads.emplace_back([t]() {
+			for (int i = 0; i < 100; ++i) {
+				dt::zone("zone " + std::to_string(i));
+				const size_t index = dt::details::get_or_add_zone_index("zone " + std::to_string(i % 10), dt::dt_state, dt::config);
+				dt::details::add_to_thread_buffer(dt::details::get_thread_buffer(dt::dt_state), index, 500);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	CHECK_EQ(dt::dt_state.zones.size(), 101);
+	CHECK_EQ(dt::dt_state.registry.load()->names.size(), 101);
+	CHECK_EQ(dt::dt_state.thread_buffers.size(), thread_count);
+	dt::details::merge_thread_buffers(dt::dt_state);
+	for (int i = 1; i <= 10; ++i)
+		CHECK_EQ(dt::dt_state.zones[i].zone_buffer, thread_count * 10 * 500);
+
+	CHECK_EQ(dt::dt_state.zones[1].thread_zone_buffers.size(), thread_count);
+	for (int t = 0; t < thread_count; ++t)
+		CHECK_EQ(dt::dt_state.zones[1].thread_zone_buffers[t], 10 * 500);
+
+	// per-thread breakdown is recorded next to the zone times
+	dt::details::record_slice(dt::dt_state, 16);
+	CHECK_EQ(dt::dt_state.zones[1].zone_times.size(), 1);
+	CHECK_EQ(dt::dt_state.zones[1].thread_zone_sums.size(), thread_count);
+	CHECK_EQ(dt::dt_state.zones[1].thread_zone_sums[2], 10 * 500);
+	const std::vector<dt::ZoneResult> zone_results = dt::details::get_zone_results(dt::dt_state.zones, 0.001, dt::config);
+	CHECK_EQ(zone_results[1].thread_zonetime_means.size(), thread_count);
+	CHECK_EQ(zone_results[1].thread_zonetime_means[3], doctest::Approx(10 * 0.5));
+
+	// merging again only adds what's new
+	dt::details::clear_zone_buffers(dt::dt_state);
+	dt::details::merge_thread_buffers(dt::dt_state);
+	CHECK_EQ(dt::dt_state.zones[1].zone_buffer, 0);
+	dt::factory_reset();
+}
+
+TEST_CASE("shared ZoneHandle after factory_reset()") {
+	dt::factory_reset();
+	static dt::ZoneHandle handle("shared handle");
+	dt::factory_reset();
+	(void)dt::zone("first");
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t)
+		threads.emplace_back([]() { CHECK_EQ(handle.get_index(), 2); });
+	for (std::thread& thread : threads)
+		thread.join();
+	CHECK_EQ(dt::dt_state.zones.size(), 3);
+	dt::factory_reset();
+}
+#endif // DT_THREADSAFE
+
+TEST_CASE("registry versions are retired") {
+	dt::factory_reset();
+	for (int i = 0; i < 50; ++i)
+		(void)dt::zone("zone " + std::to_string(i));
+	CHECK_EQ(dt::dt_state.registry_versions.retired.size(), 49);
+	CHECK_EQ(dt::dt_state.registry_versions.current.get(), dt::dt_state.registry.load());
+	dt::slice(1.0);
+	CHECK(dt::dt_state.registry_versions.retired.empty());
+	CHECK_EQ(dt::dt_state.registry.load()->names.size(), 51);
+
+	// a lookup that started before the replacement may still read it
+	dt::details::ThreadBuffer& buffer = dt::details::get_thread_buffer(dt::dt_state);
+	{
+		const dt::details::ReadGuard guard(dt::dt_state, buffer);
+		const dt::Registry* registry = dt::dt_state.registry.load();
+		(void)dt::zone("new zone");
+		dt::slice(1.0);
+		CHECK_EQ(dt::dt_state.registry_versions.retired.size(), 1);
+		CHECK_EQ(registry->names.size(), 51);
+	}
+	// one that started after it can't
+	{
+		const dt::details::ReadGuard guard(dt::dt_state, buffer);
+		dt::slice(1.0);
+		CHECK(dt::dt_state.registry_versions.retired.empty());
+	}
+	dt::factory_reset();
+}
+
+TEST_CASE("slices without any zone") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(2);
+	dt::set_sample_count(10);
+	dt::start();
+	for (int i = 0; i < 15; ++i)
+		dt::slice(1.0);
+	REQUIRE_EQ(dt::dt_state.zones.size(), 1);
+	CHECK_EQ(dt::dt_state.zones[0].frame_times.size(), 10);
+	REQUIRE(dt::are_results_ready());
+	CHECK_EQ(dt::results.zone_results[0].sorted_frame_times.size(), 10);
+	CHECK(dt::results.zone_results[0].frame_ticks.empty()); // no raw ticks by default
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("target config snapshots") {
+	dt::factory_reset();
+	dt::zone("a");
+	dt::zone("b");
+	dt::dt_state.speedups.push_back({ 2, {} });
+	dt::details::set_target_config(dt::dt_state, dt::details::speedup_config_offset);
+	const dt::TargetConfig& speedup = dt::details::get_target(dt::dt_state);
+	CHECK_EQ(speedup.speedup_zone, 2);
+	CHECK_EQ(speedup.target_zone, 0);
+	CHECK(dt::zone("b"));
+	dt::details::set_target_config(dt::dt_state, 2);
+	CHECK_EQ(dt::details::get_target(dt::dt_state).speedup_zone, 0);
+	CHECK_FALSE(dt::zone("b"));
+	// one per configuration, switching back doesn't make another
+	const size_t snapshot_count = dt::dt_state.target_snapshots.size();
+	dt::details::set_target_config(dt::dt_state, dt::details::speedup_config_offset);
+	CHECK_EQ(&dt::details::get_target(dt::dt_state), &speedup);
+	dt::details::set_target_config(dt::dt_state, 2);
+	CHECK_EQ(dt::dt_state.target_snapshots.size(), snapshot_count);
+	dt::details::set_target_config(dt::dt_state, 0);
+	CHECK_EQ(&dt::details::get_target(dt::dt_state), &dt::details::null_target_config);
+	// a zone check may still hold one, they're kept until factory_reset()
+	dt::start();
+	dt::slice(1.0);
+	CHECK_EQ(speedup.speedup_zone, 2);
+	CHECK_EQ(dt::dt_state.target_snapshots.size(), snapshot_count);
+	dt::factory_reset();
+	CHECK(dt::dt_state.target_snapshots.empty());
+	CHECK(dt::details::is_null_run(dt::details::get_target(dt::dt_state)));
+}
+
+TEST_CASE("done callback runs without the lock") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(5);
+	dt::set_done_callback([](const std::vector<dt::ZoneResult>&) {
+		(void)dt::zone("registered in the callback");
+	});
+	dt::start();
+	for (int i = 0; i < 100 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		(void)dt::zone("zone");
+		dt::slice(1.0);
+	}
+	CHECK(dt::are_results_ready());
+	CHECK_EQ(dt::dt_state.zones.size(), 3);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("interleaved schedule") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_sample_count(20);
+	dt::set_warmup_runs(2);
+	dt::set_schedule_mode(dt::ScheduleMode::Interleaved);
+	dt::set_interleave_block_size(3);
+	dt::set_switch_warmup_runs(1);
+
+	dt::start();
+	int switch_count = 0;
+	size_t last_target = 0;
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		dt::zone("a");
+		dt::zone("b");
+		dt::zone("c");
+		if (dt::details::get_target(dt::dt_state).target_zone != last_target)
+			++switch_count;
+		last_target = dt::details::get_target(dt::dt_state).target_zone;
+		dt::slice(1.0);
+	}
+	CHECK_EQ(dt::dt_state.status, dt::Status::Ready);
+	for (const dt::Zone& zone : dt::dt_state.zones)
+		CHECK_EQ(zone.frame_times.size(), 20);
+	// 4 configurations with 20 samples in blocks of at most 3
+	CHECK_GE(switch_count, 4 * 20 / 3 / 2);
+
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("get_bootstrap_median()") {
+	// compare against a brute force bootstrap
+	std::uint64_t rng = 7;
+	for (const size_t n : { 5, 6 }) {
+		std::vector<double> sorted;
+		for (size_t i = 0; i < n; ++i)
+			sorted.push_back(static_cast<double>(i * i));
+		double fast_mean = 0.0, brute_mean = 0.0;
+		constexpr int resamples = 20000;
+		for (int r = 0; r < resamples; ++r) {
+			fast_mean += dt::details::get_bootstrap_median(sorted, rng);
+			std::vector<double> resample;
+			for (size_t i = 0; i < n; ++i)
+				resample.push_back(sorted[dt::details::get_random_below(rng, n)]);
+			std::sort(resample.begin(), resample.end());
+			brute_mean += dt::details::get_median(resample);
+		}
+		CHECK_EQ(fast_mean / resamples, doctest::Approx(brute_mean / resamples).epsilon(0.03));
+	}
+}
+
+TEST_CASE("get_bootstrap_median_diff_ci()") {
+	std::vector<double> baseline, faster;
+	std::uint64_t rng = 3;
+	for (int i = 0; i < 1000; ++i) {
+		baseline.push_back(10.0 + dt::details::get_random_normal(rng));
+		faster.push_back(9.0 + dt::details::get_random_normal(rng));
+	}
+	std::sort(baseline.begin(), baseline.end());
+	std::sort(faster.begin(), faster.end());
+	double low, high;
+	dt::details::get_bootstrap_median_diff_ci(faster, baseline, 1000, rng, low, high);
+	const double diff = dt::details::get_median(faster) - dt::details::get_median(baseline);
+	CHECK_LT(low, diff);
+	CHECK_GT(high, diff);
+	CHECK_LT(high - low, 0.5);
+	dt::details::get_bootstrap_median_diff_ci(faster, baseline, 0, rng, low, high);
+	CHECK_EQ(low, 0.0);
+}
+
+TEST_CASE("get_percentile()") {
+	const std::vector<double> v{ 1.0, 2.0, 3.0, 4.0, 5.0 };
+	CHECK_EQ(dt::details::get_percentile(v, 50.0), doctest::Approx(3.0));
+	CHECK_EQ(dt::details::get_percentile(v, 90.0), doctest::Approx(4.6));
+	CHECK_EQ(dt::details::get_percentile(v, 100.0), doctest::Approx(5.0));
+	CHECK_EQ(dt::details::get_percentile({}, 50.0), doctest::Approx(0.0));
+}
+
+TEST_CASE("select_evaluated_ranks()") {
+	std::uint64_t rng = 11;
+	for (const size_t n : { 1, 2, 7, 100, 10'001 }) {
+		std::vector<double> selected;
+		for (size_t i = 0; i < n; ++i)
+			selected.push_back(static_cast<double>(dt::details::get_random_below(rng, 1000)));
+		std::vector<double> sorted = selected;
+		std::sort(sorted.begin(), sorted.end());
+		const std::vector<double> percentiles{ 0.0, 50.0, 90.0, 99.9 };
+		dt::details::select_evaluated_ranks(selected, percentiles, true);
+		CHECK_EQ(dt::details::get_median(selected), dt::details::get_median(sorted));
+		CHECK_EQ(selected.back(), sorted.back());
+		for (const double percentile : percentiles)
+			CHECK_EQ(dt::details::get_percentile(selected, percentile), dt::details::get_percentile(sorted, percentile));
+		// the bootstrap reads around the middle
+		for (size_t i = n / 2 - std::min<size_t>(n / 2, 10); i < std::min(n, n / 2 + 10); ++i)
+			CHECK_EQ(selected[i], sorted[i]);
+	}
+}
+
+TEST_CASE("lazy SortedTimes") {
+	const auto measure = []() {
+		dt::factory_reset();
+		dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+		dt::set_warmup_runs(0);
+		dt::set_sample_count(50);
+		dt::start();
+		for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+			dt::zone("zone");
+			dt::slice(10.0 + (i * 7919 % 50) * 0.01);
+		}
+		return dt::results.zone_results;
+	};
+	const dt::Config old_config = dt::config;
+	dt::set_bootstrap_resamples(0); // its window would cover all 50 samples
+	for (const dt::SignificanceTest test : { dt::SignificanceTest::MannWhitney, dt::SignificanceTest::Welch }) {
+		dt::set_significance_test(test, 0.05);
+		const std::vector<dt::ZoneResult> zone_results = measure();
+		const dt::SortedTimes& times = zone_results[1].sorted_frame_times;
+		CHECK_FALSE(times.m_sorted);
+		CHECK_FALSE(std::is_sorted(times.m_times.begin(), times.m_times.end()));
+		CHECK_EQ(times.size(), 50);
+		const std::vector<double>& sorted = times;
+		CHECK(times.m_sorted);
+		CHECK(std::is_sorted(sorted.begin(), sorted.end()));
+		std::vector<double> copy = sorted;
+		CHECK_EQ(zone_results[1].median, dt::details::get_median(copy));
+		CHECK_EQ(zone_results[1].worst_time, sorted.back());
+		const std::vector<double>& zone_times = zone_results[1].sorted_zone_times;
+		CHECK(std::is_sorted(zone_times.begin(), zone_times.end()));
+		if (test == dt::SignificanceTest::MannWhitney) {
+			const double p_value = dt::details::get_mann_whitney_p_value(sorted, zone_results[0].sorted_frame_times);
+			CHECK_EQ(zone_results[1].p_value, doctest::Approx(p_value));
+		}
+	}
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("reject_outliers()") {
+	const auto get_samples = []() {
+		std::vector<double> v;
+		for (int i = 0; i < 100; ++i)
+			v.push_back(10.0 + (i % 10) * 0.1);
+		v.push_back(50.0); // a page fault
+		v.push_back(0.5);
+		return v;
+	};
+	using dt::OutlierPolicy;
+	for (const OutlierPolicy policy : { OutlierPolicy::Mad, OutlierPolicy::Iqr }) {
+		std::vector<double> v = get_samples();
+		CHECK_EQ(dt::details::reject_outliers(v, policy, policy == OutlierPolicy::Mad ? 3.5 : 1.5), 2);
+		CHECK_EQ(v.size(), 100);
+		CHECK_EQ(*std::max_element(v.begin(), v.end()), doctest::Approx(10.9));
+	}
+
+	std::vector<double> v = get_samples();
+	CHECK_EQ(dt::details::reject_outliers(v, OutlierPolicy::TrimmedMean, 0.05), 10);
+	CHECK_EQ(v.size(), 92);
+	CHECK_EQ(*std::min_element(v.begin(), v.end()), doctest::Approx(10.0));
+	CHECK_EQ(*std::max_element(v.begin(), v.end()), doctest::Approx(10.9));
+
+	v = get_samples();
+	CHECK_EQ(dt::details::reject_outliers(v, OutlierPolicy::None, 0.0), 0);
+	std::vector<double> constant(50, 3.0);
+	CHECK_EQ(dt::details::reject_outliers(constant, OutlierPolicy::Mad, 3.5), 0);
+}
+
+TEST_CASE("outlier policy parameters") {
+	const dt::Config old_config = dt::config;
+	// the trimmed fraction doesn't inherit the 3.5 of the other policies
+	dt::set_outlier_policy(dt::OutlierPolicy::Mad, 3.5);
+	dt::set_outlier_policy(dt::OutlierPolicy::TrimmedMean, 0.1);
+	CHECK_EQ(dt::config.outlier_threshold, doctest::Approx(3.5));
+	CHECK_EQ(dt::config.trim_fraction, doctest::Approx(0.1));
+	dt::set_outlier_policy(dt::OutlierPolicy::TrimmedMean, 3.5);
+	CHECK_LT(dt::config.trim_fraction, 0.5);
+	dt::set_outlier_policy(dt::OutlierPolicy::TrimmedMean, -1.0);
+	CHECK_EQ(dt::config.trim_fraction, 0.0);
+	dt::config = old_config;
+}
+
+TEST_CASE("outlier policy in the results") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(50);
+	dt::set_outlier_policy(dt::OutlierPolicy::Mad, 3.5);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		dt::zone("zone");
+		const bool spike = dt::details::get_target(dt::dt_state).target_zone == 1 && dt::dt_state.zones[1].frame_count == 20;
+		dt::slice(spike ? 100.0 : 10.0 + (i % 5) * 0.1);
+	}
+	const std::vector<dt::ZoneResult>& zone_results = dt::results.zone_results;
+	CHECK_EQ(zone_results[0].rejected_count, 0);
+	CHECK_EQ(zone_results[1].rejected_count, 1);
+	CHECK_EQ(zone_results[1].sorted_frame_times.size(), 49);
+	CHECK_LT(zone_results[1].worst_time, 11.0);
+	CHECK_NE(dt::results.result_str.find("rejected"), std::string::npos);
+	CHECK_EQ(dt::results.result_str.find("timezone overhead"), std::string::npos); // no timezone ran
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("pairwise interactions") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::set_interaction_mode(dt::InteractionMode::Pairwise);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		const bool a = dt::zone("a");
+		const bool b = dt::zone("b");
+		const bool c = dt::zone("c");
+		// a and b share a cost that only goes away with both of them
+		const double shared = (a || b) ? 4.0 : 0.0;
+		dt::slice(10.0 + (a ? 2.0 : 0.0) + (b ? 3.0 : 0.0) + (c ? 1.0 : 0.0) + shared);
+	}
+	REQUIRE(dt::are_results_ready());
+	CHECK_EQ(dt::results.zone_results[1].median, doctest::Approx(18.0));
+	const std::vector<dt::InteractionResult>& interaction_results = dt::results.interaction_results;
+	REQUIRE_EQ(interaction_results.size(), 3);
+	CHECK_EQ(interaction_results[0].result.name, "a & b");
+	CHECK_EQ(interaction_results[0].zone_a, 1);
+	CHECK_EQ(interaction_results[0].zone_b, 2);
+	CHECK_EQ(interaction_results[0].result.median, doctest::Approx(11.0));
+	CHECK_EQ(interaction_results[0].interaction, doctest::Approx(4.0));
+	CHECK_EQ(interaction_results[1].interaction, doctest::Approx(0.0));
+	CHECK_EQ(interaction_results[2].zone_a, 2);
+	CHECK_EQ(interaction_results[2].zone_b, 3);
+	CHECK_NE(dt::results.result_str.find("w/o a & b:"), std::string::npos);
+	CHECK_EQ(dt::details::get_target(dt::dt_state).disabled_mask, 0);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("pairwise zone limit") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(2);
+	dt::set_interaction_mode(dt::InteractionMode::Pairwise);
+	dt::set_max_pairwise_zones(3);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		for (int z = 0; z < 5; ++z)
+			dt::zone("zone " + std::to_string(z));
+		dt::slice(10.0);
+	}
+	REQUIRE(dt::are_results_ready());
+	CHECK_EQ(dt::results.interaction_results.size(), 3);
+	CHECK_NE(dt::results.result_str.find("only the first 3 of 5 zones are paired"), std::string::npos);
+	dt::set_max_pairwise_zones(100);
+	CHECK_EQ(dt::config.max_pairwise_zones, 63);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+#ifdef DT_THREADSAFE
+TEST_CASE("virtual speedup delays") {
+	dt::factory_reset();
+	const std::int64_t ms_ticks = static_cast<std::int64_t>(1.0 / dt::details::clock_type::calibrate());
+	const size_t fast = dt::details::get_or_add_zone_index("fast", dt::dt_state, dt::config);
+	(void)dt::details::get_or_add_zone_index("other", dt::dt_state, dt::config);
+	dt::dt_state.speedup_fraction = 0.5;
+	dt::dt_state.speedups.push_back({ fast, {} });
+	dt::details::set_target_config(dt::dt_state, dt::details::speedup_config_offset);
+	dt::dt_state.status = dt::Status::Measuring; // timezones are inert otherwise
+
+	std::atomic<bool> worker_ready{ false };
+	std::atomic<bool> fast_done{ false };
+	std::int64_t waited = 0;
+	std::thread worker([&]() {
+		(void)dt::details::get_thread_buffer(dt::dt_state);
+		worker_ready = true;
+		while (!fast_done)
+			std::this_thread::yield();
+		const std::int64_t t0 = dt::details::clock_type::now();
+		{
+			const auto guard = dt::timezone("other");
+		}
+		waited = dt::details::clock_type::now() - t0;
+	});
+	while (!worker_ready)
+		std::this_thread::yield();
+	const std::int64_t delay_before = dt::dt_state.speedup_delay;
+	{
+		const auto guard = dt::timezone("fast");
+		dt::details::spin_for(2 * ms_ticks);
+	}
+	const std::int64_t delay = dt::dt_state.speedup_delay - delay_before;
+	CHECK_GE(delay, ms_ticks * 99 / 100);
+	CHECK_LT(delay, 2 * ms_ticks);
+
+	// the sped up thread itself doesn't wait, others do
+	const std::int64_t t0 = dt::details::clock_type::now();
+	{
+		const auto guard = dt::timezone("other");
+	}
+	CHECK_LT(dt::details::clock_type::now() - t0, ms_ticks / 2);
+	fast_done = true;
+	worker.join();
+	CHECK_GE(waited, delay);
+
+	dt::details::set_target_config(dt::dt_state, 0);
+	dt::dt_state.status = dt::Status::Ready;
+	dt::factory_reset();
+}
+#endif // DT_THREADSAFE
+
+TEST_CASE("virtual speedup results") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::set_virtual_speedup(0.5);
+	const std::int64_t ms_ticks = static_cast<std::int64_t>(1.0 / dt::details::clock_type::calibrate());
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		if (auto guard = dt::timezone("a"))
+			dt::details::spin_for(2 * ms_ticks);
+		if (auto guard = dt::timezone("b"))
+			dt::details::spin_for(ms_ticks);
+		if (dt::zone("c"))
+			dt::details::spin_for(ms_ticks / 2);
+		dt::slice();
+	}
+	REQUIRE(dt::are_results_ready());
+	const double baseline = dt::results.zone_results[0].median;
+	// "c" never had a timezone, sped up it would just be the baseline again
+	const std::vector<dt::ZoneResult>& speedup_results = dt::results.speedup_results;
+	REQUIRE_EQ(speedup_results.size(), 2);
+	CHECK_EQ(speedup_results[0].name, "a");
+	CHECK_EQ(speedup_results[0].median, doctest::Approx(baseline - 1.0).epsilon(0.1));
+	CHECK_EQ(speedup_results[1].median, doctest::Approx(baseline - 0.5).epsilon(0.1));
+	CHECK_NE(dt::results.result_str.find("faster a:"), std::string::npos);
+	CHECK_EQ(dt::results.result_str.find("faster c:"), std::string::npos);
+	CHECK_EQ(dt::details::get_target(dt::dt_state).speedup_zone, 0);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("virtual speedup validation") {
+	const dt::Config old_config = dt::config;
+	dt::set_virtual_speedup(1.0);
+	CHECK_EQ(dt::config.virtual_speedup, 0.0);
+	dt::set_virtual_speedup(-0.2);
+	CHECK_EQ(dt::config.virtual_speedup, 0.0);
+	dt::set_virtual_speedup(0.2);
+	CHECK_EQ(dt::config.virtual_speedup, doctest::Approx(0.2));
+	// set directly, it's still ignored
+	dt::config.virtual_speedup = 1.5;
+	CHECK_EQ(dt::details::get_virtual_speedup(dt::config), 0.0);
+	dt::config = old_config;
+}
+
+TEST_CASE("variants") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	CHECK_EQ(dt::variant("cull", 3), 0);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		constexpr double cull_times[] = { 4.0, 2.0, 5.0 };
+		const int cull = dt::variant("cull", 3);
+		const double z = dt::zone("z") ? 1.0 : 0.0;
+		dt::slice(10.0 + cull_times[cull] + z);
+	}
+	REQUIRE(dt::are_results_ready());
+	CHECK_EQ(dt::results.zone_results.size(), 2);
+	CHECK_EQ(dt::results.zone_results[1].median, doctest::Approx(14.0));
+	const std::vector<dt::ZoneResult>& variant_results = dt::results.variant_results;
+	REQUIRE_EQ(variant_results.size(), 2);
+	CHECK_EQ(variant_results[0].name, "cull #1");
+	CHECK_EQ(variant_results[0].median, doctest::Approx(13.0));
+	CHECK_EQ(variant_results[1].median, doctest::Approx(16.0));
+	CHECK_LT(variant_results[1].p_value, 0.05);
+	CHECK_NE(dt::results.result_str.find("cull #2:"), std::string::npos);
+	CHECK_EQ(dt::variant("cull", 3), 0);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("workloads") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	CHECK_EQ(dt::workload("particles"), 1.0);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		const double fraction = dt::workload("particles");
+		dt::slice(10.0 + 4.0 * fraction + (i % 3) * 0.1);
+	}
+	REQUIRE(dt::are_results_ready());
+	REQUIRE_EQ(dt::results.workload_results.size(), 1);
+	const dt::WorkloadResult& result = dt::results.workload_results.front();
+	CHECK_EQ(result.name, "particles");
+	CHECK_EQ(result.cost, doctest::Approx(4.0).epsilon(0.02));
+	CHECK_GT(result.cost_ci, 0.0);
+	CHECK_LT(result.cost_ci, 0.2);
+	CHECK_EQ(result.fixed_time, doctest::Approx(10.1).epsilon(0.02));
+	REQUIRE_EQ(result.fraction_results.size(), 3);
+	CHECK_EQ(result.fraction_results[0].name, "particles x0.25");
+	CHECK_EQ(result.fraction_results[1].median, doctest::Approx(12.1).epsilon(0.01));
+	CHECK_NE(dt::results.result_str.find("particles:"), std::string::npos);
+	CHECK_EQ(dt::workload("particles"), 1.0);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("workload fraction validation") {
+	const dt::Config old_config = dt::config;
+	dt::set_workload_fractions({ 0.5, -0.5, 1.0, 1.5, 0.5, 0.0 });
+	CHECK_EQ(dt::config.workload_fractions, std::vector<double>{ 0.5, 0.0 });
+	// nothing valid keeps the previous ones
+	dt::set_workload_fractions({});
+	CHECK_EQ(dt::config.workload_fractions, std::vector<double>{ 0.5, 0.0 });
+	dt::set_workload_fractions({ 1.0 });
+	CHECK_EQ(dt::config.workload_fractions, std::vector<double>{ 0.5, 0.0 });
+
+	// set directly, the invalid ones are skipped and there is nothing to fit
+	dt::factory_reset();
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(5);
+	dt::config.workload_fractions = { 1.0, -1.0 };
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		const double fraction = dt::workload("particles");
+		dt::slice(10.0 + 4.0 * fraction);
+	}
+	REQUIRE(dt::are_results_ready());
+	CHECK(dt::results.workload_results.empty());
+	CHECK_EQ(dt::results.result_str.find("workloads:"), std::string::npos);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("nested zones") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		double frame_time = 10.0;
+		if (auto shadows = dt::timezone("shadows")) {
+			frame_time += 2.0;
+			if (auto cascades = dt::timezone("cascades"))
+				frame_time += 3.0;
+		}
+		if (auto bunnies = dt::timezone("bunnies"))
+			frame_time += 1.0;
+		dt::slice(frame_time);
+	}
+	REQUIRE(dt::are_results_ready());
+	CHECK_EQ(dt::dt_state.zones[2].parent, 1);
+	const std::vector<dt::ZoneResult>& zone_results = dt::results.zone_results;
+	CHECK_EQ(zone_results[1].parent, 0);
+	CHECK_EQ(zone_results[2].parent, 1);
+	CHECK_EQ(zone_results[3].parent, 0);
+	CHECK_EQ(zone_results[1].inclusive_delta, doctest::Approx(-5.0));
+	CHECK_EQ(zone_results[1].exclusive_delta, doctest::Approx(-2.0));
+	CHECK_EQ(zone_results[2].exclusive_delta, doctest::Approx(-3.0));
+	CHECK_EQ(zone_results[3].exclusive_delta, doctest::Approx(-1.0));
+	CHECK_NE(dt::results.result_str.find("\n  w/o cascades:"), std::string::npos);
+	CHECK_NE(dt::results.result_str.find("excl[ms]"), std::string::npos);
+	CHECK_EQ(dt::details::get_open_timezone(), 0);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("plain zones nested in a timezone") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		double frame_time = 10.0;
+		if (auto shadows = dt::timezone("shadows")) {
+			frame_time += 2.0;
+			if (dt::zone("cascades"))
+				frame_time += 3.0;
+			static dt::ZoneHandle filtering("filtering");
+			if (dt::zone(filtering))
+				frame_time += 1.0;
+		}
+		if (dt::zone("bunnies"))
+			frame_time += 1.0;
+		dt::slice(frame_time);
+	}
+	REQUIRE(dt::are_results_ready());
+	const std::vector<dt::ZoneResult>& zone_results = dt::results.zone_results;
+	CHECK_EQ(zone_results[2].parent, 1);
+	CHECK_EQ(zone_results[3].parent, 1);
+	CHECK_EQ(zone_results[4].parent, 0);
+	CHECK_EQ(zone_results[1].inclusive_delta, doctest::Approx(-6.0));
+	CHECK_EQ(zone_results[1].exclusive_delta, doctest::Approx(-2.0));
+	CHECK_EQ(zone_results[2].exclusive_delta, doctest::Approx(-3.0));
+	CHECK_NE(dt::results.result_str.find("\n  w/o cascades:"), std::string::npos);
+	CHECK_NE(dt::results.result_str.find("timezone overhead"), std::string::npos);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("trace export") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::set_trace_capacity(16);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		if (auto shadows = dt::timezone("shadows")) {
+			if (auto cascades = dt::timezone("cascades \"csm\""))
+				dt::details::spin_for(10);
+		}
+		dt::slice();
+	}
+	REQUIRE(dt::are_results_ready());
+	// the baseline alone has more events than fit, so the ring wrapped
+	CHECK_EQ(dt::dt_state.trace.storage.load()->capacity, 16);
+	CHECK_GT(dt::dt_state.trace.next.load(), 16);
+	const std::vector<dt::details::TraceEvent> events = dt::details::get_trace_events(dt::dt_state.trace);
+	REQUIRE_EQ(events.size(), 16);
+	for (size_t i = 0; i < 16; ++i) {
+		CHECK_LE(events[i].t0, events[i].t1);
+		CHECK_LE(events[i].zone_index, 2);
+		if (i > 0)
+			CHECK_LE(events[i - 1].t1, events[i].t1);
+	}
+
+	const std::string path = "dt_trace_test.json";
+	REQUIRE(dt::write_trace_json(path));
+	std::ifstream file(path);
+	const std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+	std::remove(path.c_str());
+	CHECK_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0);
+	CHECK_NE(json.find("\"ph\":\"X\""), std::string::npos);
+	CHECK_NE(json.find("\"name\":\"frame\""), std::string::npos);
+	CHECK_NE(json.find("\"name\":\"shadows\""), std::string::npos);
+	CHECK_NE(json.find("\"name\":\"cascades \\\"csm\\\"\""), std::string::npos);
+	size_t event_count = 0;
+	for (size_t pos = json.find("\"ph\":\"X\""); pos != std::string::npos; pos = json.find("\"ph\":\"X\"", pos + 1))
+		++event_count;
+	CHECK_EQ(event_count, 16);
+	CHECK_FALSE(dt::write_trace_json("/nonexistent_dir/trace.json"));
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("trace storage is replaced, not reallocated") {
+	dt::factory_reset();
+	dt::details::ThreadBuffer& buffer = dt::details::get_thread_buffer(dt::dt_state);
+	dt::details::resize_trace(dt::dt_state, 8);
+	dt::details::TraceBuffer::Storage* first = dt::dt_state.trace.storage;
+	dt::details::record_trace_event(dt::dt_state, buffer, 0, 1, 2);
+	dt::details::resize_trace(dt::dt_state, 8);
+	CHECK_EQ(dt::dt_state.trace.storage.load(), first);
+	{
+		// a writer that loaded the old storage can still write into it
+		const dt::details::ReadGuard guard(dt::dt_state, buffer);
+		dt::details::resize_trace(dt::dt_state, 4);
+		CHECK_NE(dt::dt_state.trace.storage.load(), first);
+		dt::slice(1.0);
+		CHECK_EQ(dt::dt_state.trace.storages.retired.size(), 1);
+		first->events[0] = { 0, 0, 3, 4 };
+	}
+	dt::slice(1.0);
+	CHECK(dt::dt_state.trace.storages.retired.empty());
+	dt::details::resize_trace(dt::dt_state, 0);
+	CHECK_EQ(dt::dt_state.trace.storage.load(), nullptr);
+	CHECK(dt::details::get_trace_events(dt::dt_state.trace).empty());
+	dt::details::resize_trace(dt::dt_state, 0);
+	dt::factory_reset();
+}
+
+TEST_CASE("result export") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(10);
+	dt::set_raw_tick_keeping(true);
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		double frame_time = 10.0;
+		if (dt::zone("shadows"))
+			frame_time += 2.0;
+		if (dt::zone("bunnies, \"hq\""))
+			frame_time += 1.0;
+		dt::slice(frame_time);
+	}
+	REQUIRE(dt::are_results_ready());
+	const auto read_file = [](const std::string& path) {
+		std::ifstream file(path);
+		std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+		std::remove(path.c_str());
+		return content;
+	};
+	const auto count = [](const std::string& str, const std::string& part) {
+		size_t n = 0;
+		for (size_t pos = str.find(part); pos != std::string::npos; pos = str.find(part, pos + 1))
+			++n;
+		return n;
+	};
+
+	// the export has the config of the measurement, not the current one
+	dt::set_sample_count(20);
+	REQUIRE(dt::write_results_json("dt_results_test.json"));
+	const std::string json = read_file("dt_results_test.json");
+	CHECK_EQ(json.rfind("{\n\"meta\":{\"clock\":", 0), 0);
+	CHECK_NE(json.find("\"config\":{\"report_time_mode\":\"ms\",\"target_sample_count\":10,"), std::string::npos);
+	CHECK_NE(json.find("{\"name\":\"shadows\",\"median\":11,"), std::string::npos);
+	CHECK_NE(json.find("{\"name\":\"bunnies, \\\"hq\\\"\",\"median\":12,"), std::string::npos);
+	CHECK_NE(json.find("\"frame_times\":[13,13,13,13,13,13,13,13,13,13]"), std::string::npos);
+	CHECK_EQ(count(json, "\"frame_times\":"), 3);
+	CHECK_EQ(count(json, "\"frame_ticks\":["), 3);
+	CHECK_EQ(json.find("\"frame_ticks\":[]"), std::string::npos);
+	CHECK_EQ(json.substr(json.size() - 4), "]\n}\n");
+
+	REQUIRE(dt::write_results_csv("dt_results_test.csv"));
+	const std::string csv = read_file("dt_results_test.csv");
+	CHECK_EQ(csv.rfind("section,name,field,index,value\nmeta,,clock,,", 0), 0);
+	CHECK_NE(csv.find("\nconfig,,percentiles,1,99\n"), std::string::npos);
+	CHECK_NE(csv.find("\nconfig,,significance_level,,0.05\n"), std::string::npos);
+	CHECK_NE(csv.find("\nzone,shadows,median,,11\n"), std::string::npos);
+	CHECK_NE(csv.find("\nzone,\"bunnies, \"\"hq\"\"\",median,,12\n"), std::string::npos);
+	CHECK_EQ(count(csv, "\nzone,shadows,frame_times,"), 10);
+	CHECK_NE(csv.find("\nzone,shadows,frame_times,9,11\n"), std::string::npos);
+	CHECK_EQ(count(csv, "\nzone,shadows,frame_ticks,"), 10);
+	CHECK_NE(csv.find("\nconfig,,target_sample_count,,10\n"), std::string::npos);
+
+	CHECK_FALSE(dt::write_results_json("/nonexistent_dir/results.json"));
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("QuantileSketch") {
+	constexpr double accuracy = 0.01;
+	const double log_gamma = std::log((1.0 + accuracy) / (1.0 - accuracy));
+	dt::QuantileSketch sketch;
+	std::vector<std::int64_t> values;
+	std::uint64_t rng = 7;
+	for (int i = 0; i < 100'000; ++i) {
+		const std::int64_t value = 1'000'000 + static_cast<std::int64_t>(dt::details::get_random_below(rng, 10'000'000));
+		values.push_back(value);
+		dt::details::add_to_sketch(sketch, value, log_gamma);
+	}
+	std::sort(values.begin(), values.end());
+	for (const double q : { 0.5, 0.9, 0.99, 0.999 }) {
+		const double exact = static_cast<double>(values[static_cast<size_t>(q * (values.size() - 1))]);
+		CHECK_EQ(dt::details::get_sketch_quantile(sketch, q), doctest::Approx(exact).epsilon(accuracy * 1.1));
+	}
+	CHECK_EQ(dt::details::get_sketch_quantile(sketch, 1.0), values.back());
+	CHECK_LT(sketch.counts.size(), 300);
+
+	// a range beyond the bucket limit collapses the lowest buckets
+	for (std::int64_t value = 1; value < (std::int64_t(1) << 60); value *= 2)
+		dt::details::add_to_sketch(sketch, value, log_gamma);
+	CHECK_LE(sketch.counts.size(), dt::details::max_sketch_buckets);
+	CHECK_EQ(sketch.count, 100'000 + 60);
+	CHECK_EQ(dt::details::get_sketch_quantile(sketch, 0.5), doctest::Approx(values[50'000]).epsilon(accuracy * 1.1));
+}
+
+TEST_CASE("sketch sample storage") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(200);
+	dt::set_sample_storage(dt::SampleStorage::Sketch, 0.01);
+	dt::set_percentiles({ 90.0, 99.0, 99.9 });
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		dt::zone("zone");
+		dt::slice(dt::details::get_target(dt::dt_state).target_zone == 1 ? 5.0 + (i % 10) * 0.1 : 10.0 + (i % 10) * 0.1);
+	}
+	CHECK_EQ(dt::dt_state.status, dt::Status::Ready);
+	CHECK(dt::dt_state.zones[0].frame_times.empty());
+	CHECK_EQ(dt::dt_state.zones[0].frame_count, 200);
+	const std::vector<dt::ZoneResult>& zone_results = dt::results.zone_results;
+	CHECK(zone_results[1].sorted_frame_times.empty());
+	CHECK_EQ(zone_results[0].median, doctest::Approx(10.45).epsilon(0.015));
+	CHECK_EQ(zone_results[1].median, doctest::Approx(5.45).epsilon(0.015));
+	CHECK_EQ(zone_results[1].percentiles.size(), 3);
+	CHECK_EQ(zone_results[1].percentiles[1], doctest::Approx(5.9).epsilon(0.015));
+	CHECK_EQ(zone_results[1].worst_time, doctest::Approx(5.9));
+	CHECK_LT(zone_results[1].p_value, 0.001);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("percentile columns") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(100);
+	dt::set_percentiles({ 50.0, 99.9 });
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		dt::zone("spikes");
+		// the zone causes one in ten frames to spike, the median doesn't move
+		const bool spike = dt::details::get_target(dt::dt_state).target_zone == 0 && i % 10 == 0;
+		dt::slice(spike ? 20.0 : 10.0);
+	}
+	const std::vector<dt::ZoneResult>& zone_results = dt::results.zone_results;
+	CHECK_EQ(zone_results[1].percentiles[0], doctest::Approx(zone_results[1].median));
+	CHECK_EQ(zone_results[0].percentiles[1], doctest::Approx(20.0));
+	CHECK_EQ(zone_results[1].percentiles[1], doctest::Approx(10.0));
+
+	const dt::details::printing::ResultTable table = dt::details::printing::get_result_table(zone_results, dt::config);
+	const auto p999 = std::find_if(table.begin(), table.end(), [](const auto& column) { return column.header == "p99.9[ms]"; });
+	REQUIRE(p999 != table.end());
+	CHECK_EQ(p999->cells[1], "10.0 (-50%)");
+	// no value is an empty cell, not 0 or inf
+	dt::ZoneResult without_percentiles = zone_results[1];
+	without_percentiles.percentiles.clear();
+	dt::set_report_time_mode(dt::ReportTimeMode::Fps);
+	CHECK_EQ(dt::details::printing::get_cell_str(without_percentiles, zone_results[0], false, dt::details::printing::EvalType::Percentile, 1, dt::config), "");
+	CHECK_NE(dt::results.result_str.find("p50[ms]"), std::string::npos);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+#ifdef DT_THREADSAFE
+TEST_CASE("async evaluation") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(20);
+	dt::set_async_evaluation(true);
+	static std::atomic<int> callback_count{ 0 };
+	dt::set_done_callback([](const std::vector<dt::ZoneResult>& zone_results) {
+		CHECK_EQ(zone_results.size(), 2);
+		++callback_count;
+	});
+	CHECK_FALSE(dt::are_results_ready());
+	dt::start();
+	for (int i = 0; i < 1000 && dt::dt_state.status != dt::Status::Evaluating; ++i) {
+		dt::zone("zone");
+		dt::slice(dt::details::get_target(dt::dt_state).target_zone == 1 ? 5.0 : 10.0);
+	}
+	// slices during the evaluation are ignored, the zones stay registered
+	dt::slice(1.0);
+	CHECK(dt::zone("zone"));
+	CHECK_EQ(dt::dt_state.zones.size(), 2);
+	while (callback_count == 0)
+		std::this_thread::yield();
+	CHECK(dt::are_results_ready());
+	CHECK_EQ(callback_count, 1);
+	CHECK_EQ(dt::results.zone_results[1].median, doctest::Approx(5.0));
+	CHECK_EQ(dt::results.zone_results[0].sorted_frame_times.size(), 20);
+
+	dt::clear_results();
+	CHECK_FALSE(dt::are_results_ready());
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
+TEST_CASE("async restart from the done callback") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_sample_count(5);
+	dt::set_async_evaluation(true);
+	static std::atomic<int> callback_count{ 0 };
+	static std::atomic<int> ready_count{ 0 };
+	callback_count = 0;
+	ready_count = 0;
+	dt::set_done_callback([](const std::vector<dt::ZoneResult>&) {
+		if (dt::are_results_ready())
+			++ready_count;
+		if (++callback_count == 1)
+			dt::start();
+	});
+	dt::start();
+	for (int i = 0; i < 1'000'000 && callback_count < 2; ++i) {
+		dt::zone("zone");
+		dt::slice(10.0);
+		if (dt::dt_state.status == dt::Status::Evaluating)
+			std::this_thread::yield();
+	}
+	CHECK_EQ(callback_count, 2);
+	CHECK_EQ(ready_count, 2);
+	dt::config = old_config;
+	dt::factory_reset();
+}
+#endif // DT_THREADSAFE
+
+TEST_CASE("significance tests") {
+	// reference values for the normal approximation and the t distribution
+	const std::vector<double> a{ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 };
+	const std::vector<double> b{ 3.0, 5.0, 7.0, 8.0, 9.0, 10.0, 11.0 };
+	CHECK_EQ(dt::details::get_mann_whitney_p_value(a, b), doctest::Approx(0.0264).epsilon(0.01));
+	CHECK_EQ(dt::details::get_welch_p_value(a, b), doctest::Approx(0.0106).epsilon(0.01));
+	CHECK_EQ(dt::details::get_mann_whitney_p_value(a, a), doctest::Approx(1.0));
+	CHECK_EQ(dt::details::get_welch_p_value(a, a), doctest::Approx(1.0));
+	CHECK_EQ(dt::details::get_incomplete_beta(2.0, 3.0, 0.4), doctest::Approx(0.5248));
+
+	std::uint64_t rng = 5;
+	std::vector<double> baseline, same;
+	for (int i = 0; i < 500; ++i) {
+		baseline.push_back(10.0 + dt::details::get_random_normal(rng));
+		same.push_back(10.0 + dt::details::get_random_normal(rng));
+	}
+	std::sort(baseline.begin(), baseline.end());
+	std::sort(same.begin(), same.end());
+	CHECK_GT(dt::details::get_mann_whitney_p_value(same, baseline), 0.01);
+	CHECK_GT(dt::details::get_welch_p_value(same, baseline), 0.01);
+}
+
+TEST_CASE("get_t_quantile_95()") {
+	CHECK_EQ(dt::details::get_t_quantile_95(10.0), doctest::Approx(2.228).epsilon(0.002));
+	CHECK_EQ(dt::details::get_t_quantile_95(30.0), doctest::Approx(2.042).epsilon(0.001));
+	CHECK_EQ(dt::details::get_t_quantile_95(1e9), doctest::Approx(1.960).epsilon(0.001));
+}
+
+TEST_CASE("adaptive sample count") {
+	dt::factory_reset();
+	const dt::Config old_config = dt::config;
+	dt::set_report_out_mode(dt::ReportOutMode::JustEval);
+	dt::set_warmup_runs(0);
+	dt::set_adaptive_sample_count(0.05, 10, 500);
+
+	// the noisy zone needs many more samples for the same CI width
+	dt::start();
+	std::uint64_t rng = 1;
+	for (int i = 0; i < 5000 && dt::dt_state.status != dt::Status::Ready; ++i) {
+		dt::zone("quiet");
+		dt::zone("noisy");
+		const double noise = static_cast<double>(dt::details::get_random_below(rng, 1000)) / 1000.0 - 0.5;
+		const size_t target = dt::details::get_target(dt::dt_state).target_zone;
+		const double ms = target == 2 ? 8.0 + 8.0 * noise : 10.0 + 0.5 * noise;
+		dt::slice(ms);
+	}
+	CHECK_EQ(dt::dt_state.status, dt::Status::Ready);
+	const size_t baseline_n = dt::dt_state.zones[0].frame_times.size();
+	const size_t quiet_n = dt::dt_state.zones[1].frame_times.size();
+	const size_t noisy_n = dt::dt_state.zones[2].frame_times.size();
+	CHECK_GE(quiet_n, 10);
+	CHECK_LT(quiet_n, 50);
+	CHECK_GT(noisy_n, 2 * quiet_n);
+	CHECK_LE(noisy_n, 500);
+	CHECK_LE(dt::details::get_relative_ci_width(dt::dt_state.zones[0], dt::dt_state.zones[2], false), 0.05);
+	CHECK_GE(baseline_n, 10);
+
+	dt::set_adaptive_sample_count(0.05, 50, 20);
+	CHECK_EQ(dt::config.min_sample_count, 50);
+	CHECK_EQ(dt::config.max_sample_count, 50);
+	dt::set_adaptive_sample_count(0.05, 0, 20);
+	CHECK_EQ(dt::config.min_sample_count, 2);
+
+	dt::config = old_config;
+	dt::factory_reset();
+}
+
 
 void accurate_sleep(const int ms) {
 	// "accurate"... but better than sleep() or std::this_thread::sleep_for()
@@ -137,7 +1282,7 @@ int main() {
 			accurate_sleep(7);
 		}
 		t1 = std::chrono::high_resolution_clock::now();
-		const double time_delta_ms = dt::details::get_ms_from_dt(t1, t0);
+		const double time_delta_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
 		t0 = t1;
 		dt::slice(time_delta_ms);
 	}
@@ -0,0 +1,100 @@
+// Compares the vectorized mean/std dev kernels with the plain loops they
+// replaced, for speed and for accuracy against a long double reference. Build
+// with and without -mavx2 (or DT_NO_SIMD / DT_FLOATS) to compare the paths:
+// g++ -std=c++17 -O2 -mavx2 stats_benchmark.cpp
+#include "../dt.h"
+
+#include <chrono>
+#include <cstdio>
+
+
+// The previous implementations: float_type accumulators, two passes
+auto get_naive_mean(const std::vector<dt::float_type>& vec) -> dt::float_type {
+   dt::float_type sum = 0.0;
+   for (const dt::float_type value : vec)
+      sum += value;
+   return sum / vec.size();
+}
+
+
+auto get_naive_std_dev(
+   const std::vector<dt::float_type>& vec,
+   const dt::float_type mean
+) -> dt::float_type {
+   dt::float_type squares = 0.0;
+   for (const dt::float_type value : vec) {
+      const dt::float_type term = value - mean;
+      squares += term * term;
+   }
+   return std::sqrt(squares / (vec.size() - static_cast<dt::float_type>(1.0)));
+}
+
+
+auto get_reference_std_dev(const std::vector<dt::float_type>& vec) -> long double {
+   long double sum = 0.0L;
+   for (const dt::float_type value : vec)
+      sum += value;
+   const long double mean = sum / vec.size();
+   long double squares = 0.0L;
+   for (const dt::float_type value : vec)
+      squares += (value - mean) * (value - mean);
+   return std::sqrt(squares / (vec.size() - 1.0L));
+}
+
+
+// Best of a few runs, in ns per sample
+template<class Fun>
+auto get_ns_per_sample(const size_t n, Fun&& fun) -> double {
+   const int runs = n < 100'000 ? 200 : 5;
+   double best = std::numeric_limits<double>::max();
+   for (int run = 0; run < runs; ++run) {
+      const auto t0 = std::chrono::steady_clock::now();
+      fun();
+      const auto t1 = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0).count());
+   }
+   return best / static_cast<double>(n);
+}
+
+
+int main() {
+#if defined(DT_SIMD_AVX)
+   printf("kernels: AVX\n");
+#elif defined(DT_SIMD_SSE2)
+   printf("kernels: SSE2\n");
+#else
+   printf("kernels: scalar\n");
+#endif
+   printf("%10s %14s %14s %16s %16s\n", "samples", "naive[ns/x]", "simd[ns/x]", "naive rel err", "simd rel err");
+
+   std::uint64_t rng = 1;
+   for (size_t n = 1'000; n <= 10'000'000; n *= 10) {
+      // frame times around 16ms, the large offset is what hurts naive sums
+      std::vector<dt::float_type> samples(n);
+      for (dt::float_type& sample : samples)
+         sample = static_cast<dt::float_type>(16.6 + 0.5 * dt::details::get_random_normal(rng));
+
+      volatile dt::float_type sink = 0.0;
+      dt::float_type naive_std_dev = 0.0;
+      const double naive_ns = get_ns_per_sample(n, [&]() {
+         const dt::float_type mean = get_naive_mean(samples);
+         naive_std_dev = get_naive_std_dev(samples, mean);
+         sink = naive_std_dev;
+      });
+      double simd_std_dev = 0.0;
+      const double simd_ns = get_ns_per_sample(n, [&]() {
+         const dt::details::Moments moments = dt::details::get_moments(samples);
+         simd_std_dev = std::sqrt(moments.m2 / (moments.count - 1.0));
+         sink = static_cast<dt::float_type>(simd_std_dev);
+      });
+
+      const long double reference = get_reference_std_dev(samples);
+      const auto get_rel_error = [&](const long double value) {
+         return static_cast<double>(std::abs(value - reference) / reference);
+      };
+      printf(
+         "%10zu %14.3f %14.3f %16.3g %16.3g\n",
+         n, naive_ns, simd_ns, get_rel_error(naive_std_dev), get_rel_error(simd_std_dev)
+      );
+   }
+}
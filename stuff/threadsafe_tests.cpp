@@ -0,0 +1,6 @@
+// The same tests with DT_THREADSAFE, i.e. with the mutex, the thread_local
+// buffers and the tests that need threads. Built separately from
+// example_and_tests.cpp, which covers the default single-threaded mode:
+// g++ -std=c++17 -pthread threadsafe_tests.cpp
+#define DT_THREADSAFE
+#include "example_and_tests.cpp"